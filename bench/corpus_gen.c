@@ -0,0 +1,462 @@
+/**
+ * @file corpus_gen.c
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 R. Dunbar Poor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+Generate a reproducible benchmark corpus document.  For a given shape, node
+count and seed, the output is always the same, so benchmark results can be
+compared across machines and releases.
+
+Shapes:
+
+    canada   a GeoJSON feature collection: mostly arrays of float coordinates
+    twitter  an array of status objects: mostly string keys and values
+    nested   chains of objects and arrays nested MAX_DEPTH - 1 levels deep
+    numeric  long arrays of integer and float samples
+
+Each run writes <out>.json (JSON text, for parser benchmarks) and <out>.c,
+which defines `jemi_node_t *build_corpus(void)` to build the same document
+with jemi calls (for emitter benchmarks).  The pool size it needs is noted in
+the generated file.
+
+To build and run (on a POSIX / gcc style environment):
+
+gcc -O2 -Wall -I.. -o corpus_gen corpus_gen.c ../jemi.c
+./corpus_gen twitter 100000 1 twitter_100k
+
+*/
+
+// *****************************************************************************
+// Includes
+
+#include "jemi.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// *****************************************************************************
+// Private types and definitions
+
+#define MAX_DEPTH 48        // nesting limit for every shape
+#define RESERVE_NODES 64    // stop generating with this many nodes left
+#define STRING_SPACE_PER_NODE 24 // average bytes of string storage per node
+
+typedef void (*shape_fn_t)(jemi_node_t *root);
+
+// *****************************************************************************
+// Private (static) storage
+
+static uint64_t s_rng_state;
+
+static char *s_strings;     // generated strings must outlive the structure
+static size_t s_strings_size;
+static size_t s_strings_used;
+
+static const char *const s_words[] = {
+    "sensor", "gateway", "alpha",  "bravo", "river",  "north", "delta",
+    "signal", "amber",   "quartz", "orbit", "meadow", "cedar", "harbor",
+    "vector", "pixel",   "lumen",  "ember", "tundra", "comet"};
+
+// *****************************************************************************
+// Private (static, forward) declarations
+
+/**
+ * @brief Return the next pseudo-random number (splitmix64).
+ */
+static uint64_t rng_next(void);
+
+/**
+ * @brief Return a pseudo-random integer in [lo, hi].
+ */
+static int64_t rng_range(int64_t lo, int64_t hi);
+
+/**
+ * @brief Return a pseudo-random double in [lo, hi).
+ */
+static double rng_double(double lo, double hi);
+
+/**
+ * @brief Return a string of n_words random words separated by sep, stored in
+ * the string arena (or a fixed string if the arena is full).
+ */
+static const char *rng_words(int n_words, char sep);
+
+/**
+ * @brief Return true if there's room for a record of about n more nodes.
+ */
+static bool room_for(size_t n);
+
+/**
+ * @brief Append a key/value pair to an object.
+ */
+static void add_member(jemi_node_t *object, const char *key,
+                       jemi_node_t *value);
+
+static void gen_canada(jemi_node_t *root);
+static void gen_twitter(jemi_node_t *root);
+static void gen_nested(jemi_node_t *root);
+static void gen_numeric(jemi_node_t *root);
+
+/**
+ * @brief Return the generator for the named shape, or NULL.
+ */
+static shape_fn_t find_shape(const char *name);
+
+/**
+ * @brief Write root as a C function that builds it with jemi calls.
+ */
+static void write_program(FILE *fp, jemi_node_t *root, const char *args,
+                          size_t n_nodes);
+
+/**
+ * @brief Write the jemi expression that creates a leaf node.
+ */
+static void write_leaf(FILE *fp, jemi_node_t *node);
+
+/**
+ * @brief Write a C string literal.
+ */
+static void write_literal(FILE *fp, const char *string, size_t len);
+
+/**
+ * @brief jemi_chunk_writer_t that writes to a FILE.
+ */
+static void file_writer_fn(const char *buf, size_t len, void *arg);
+
+// *****************************************************************************
+// Public code
+
+int main(int argc, char **argv) {
+    shape_fn_t generate;
+    char path[256];
+    char args[256];
+    jemi_node_t *pool;
+    jemi_node_t *root;
+    size_t n_nodes;
+    FILE *fp;
+
+    if (argc != 5) {
+        fprintf(stderr, "usage: %s canada|twitter|nested|numeric <nodes> "
+                        "<seed> <out>\n", argv[0]);
+        return 1;
+    }
+    generate = find_shape(argv[1]);
+    n_nodes = strtoul(argv[2], NULL, 0);
+    if (generate == NULL || n_nodes < 2 * RESERVE_NODES) {
+        fprintf(stderr, "unknown shape or too few nodes\n");
+        return 1;
+    }
+    s_rng_state = strtoull(argv[3], NULL, 0);
+    snprintf(args, sizeof(args), "%s %s %s", argv[1], argv[2], argv[3]);
+
+    pool = calloc(n_nodes, sizeof(jemi_node_t));
+    s_strings_size = n_nodes * STRING_SPACE_PER_NODE;
+    s_strings = malloc(s_strings_size);
+    if (pool == NULL || s_strings == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    jemi_init(pool, n_nodes);
+    root = jemi_object(NULL);
+    generate(root);
+    n_nodes -= jemi_available();
+
+    snprintf(path, sizeof(path), "%s.json", argv[4]);
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        return 1;
+    }
+    jemi_emit_chunked(root, file_writer_fn, fp);
+    fclose(fp);
+
+    snprintf(path, sizeof(path), "%s.c", argv[4]);
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        return 1;
+    }
+    write_program(fp, root, args, n_nodes);
+    fclose(fp);
+
+    printf("%s: %zu nodes\n", args, n_nodes);
+    return 0;
+}
+
+// *****************************************************************************
+// Private (static) code
+
+static uint64_t rng_next(void) {
+    uint64_t z = (s_rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static int64_t rng_range(int64_t lo, int64_t hi) {
+    return lo + (int64_t)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+static double rng_double(double lo, double hi) {
+    return lo + (hi - lo) * ((rng_next() >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static const char *rng_words(int n_words, char sep) {
+    size_t n_choices = sizeof(s_words) / sizeof(s_words[0]);
+    char *start = &s_strings[s_strings_used];
+    size_t len = 0;
+
+    for (int i = 0; i < n_words; i++) {
+        const char *word = s_words[rng_next() % n_choices];
+        size_t n = strlen(word);
+        if (s_strings_used + len + n + 2 > s_strings_size) {
+            return "overflow";
+        }
+        if (i > 0) {
+            start[len++] = sep;
+        }
+        memcpy(&start[len], word, n);
+        len += n;
+    }
+    start[len] = '\0';
+    s_strings_used += len + 1;
+    return start;
+}
+
+static bool room_for(size_t n) {
+    return jemi_available() > n + RESERVE_NODES;
+}
+
+static void add_member(jemi_node_t *object, const char *key,
+                       jemi_node_t *value) {
+    jemi_object_append(object, jemi_list(jemi_string(key), value, NULL));
+}
+
+static void gen_canada(jemi_node_t *root) {
+    jemi_node_t *features = jemi_array(NULL);
+
+    add_member(root, "type", jemi_string("FeatureCollection"));
+    add_member(root, "features", features);
+    while (room_for(40)) {
+        jemi_node_t *feature = jemi_object(NULL);
+        jemi_node_t *geometry = jemi_object(NULL);
+        jemi_node_t *polygon = jemi_array(NULL);
+        double lon = rng_double(-141.0, -52.0);
+        double lat = rng_double(42.0, 83.0);
+
+        add_member(feature, "type", jemi_string("Feature"));
+        add_member(feature, "properties",
+                   jemi_object(jemi_string("name"), jemi_string(rng_words(1, ' ')),
+                               NULL));
+        add_member(geometry, "type", jemi_string("Polygon"));
+        add_member(geometry, "coordinates", polygon);
+        add_member(feature, "geometry", geometry);
+        jemi_array_append(features, feature);
+        // rings of [lon, lat] pairs, as long as the pool allows
+        while (room_for(3) && rng_range(0, 50) != 0) {
+            jemi_node_t *ring = jemi_array(NULL);
+            jemi_array_append(polygon, ring);
+            for (int64_t n = rng_range(4, 400); n > 0 && room_for(3); n--) {
+                lon += rng_double(-0.01, 0.01);
+                lat += rng_double(-0.01, 0.01);
+                jemi_array_append(ring, jemi_array(jemi_float(lon),
+                                                   jemi_float(lat), NULL));
+            }
+        }
+    }
+}
+
+static void gen_twitter(jemi_node_t *root) {
+    jemi_node_t *statuses = jemi_array(NULL);
+
+    add_member(root, "statuses", statuses);
+    while (room_for(60)) {
+        jemi_node_t *status = jemi_object(NULL);
+        jemi_node_t *user = jemi_object(NULL);
+        jemi_node_t *hashtags = jemi_array(NULL);
+
+        add_member(status, "created_at", jemi_string(rng_words(3, ' ')));
+        add_member(status, "id", jemi_integer(rng_range(1LL << 40, 1LL << 60)));
+        add_member(status, "text",
+                   jemi_string(rng_words((int)rng_range(3, 20), ' ')));
+        add_member(user, "id", jemi_integer(rng_range(1, 1LL << 32)));
+        add_member(user, "name", jemi_string(rng_words(2, ' ')));
+        add_member(user, "screen_name", jemi_string(rng_words(2, '_')));
+        add_member(user, "location", jemi_string(rng_words(1, ' ')));
+        add_member(user, "description",
+                   jemi_string(rng_words((int)rng_range(0, 12), ' ')));
+        add_member(user, "followers_count", jemi_integer(rng_range(0, 100000)));
+        add_member(user, "verified", jemi_bool(rng_range(0, 9) == 0));
+        add_member(status, "user", user);
+        for (int64_t n = rng_range(0, 4); n > 0; n--) {
+            jemi_array_append(hashtags,
+                              jemi_object(jemi_string("text"),
+                                          jemi_string(rng_words(1, ' ')), NULL));
+        }
+        add_member(status, "entities",
+                   jemi_object(jemi_string("hashtags"), hashtags, NULL));
+        add_member(status, "in_reply_to_status_id", jemi_null());
+        add_member(status, "retweet_count", jemi_integer(rng_range(0, 5000)));
+        add_member(status, "lang", jemi_string(rng_range(0, 3) ? "en" : "ja"));
+        jemi_array_append(statuses, status);
+    }
+}
+
+static void gen_nested(jemi_node_t *root) {
+    jemi_node_t *branches = jemi_array(NULL);
+
+    add_member(root, "branches", branches);
+    while (room_for(4 * MAX_DEPTH)) {
+        // a chain of alternating objects and arrays, MAX_DEPTH - 2 levels deep
+        jemi_node_t *node = jemi_object(NULL);
+        jemi_array_append(branches, node);
+        for (int depth = 2; depth < MAX_DEPTH - 1; depth++) {
+            jemi_node_t *child = (depth & 1) ? jemi_object(NULL)
+                                             : jemi_array(NULL);
+            if (node->type == JEMI_OBJECT) {
+                add_member(node, rng_words(1, ' '), child);
+            } else {
+                jemi_array_append(node, jemi_list(jemi_integer(depth), child,
+                                                  NULL));
+            }
+            node = child;
+        }
+        jemi_array_append(node, jemi_string(rng_words(2, ' ')));
+    }
+}
+
+static void gen_numeric(jemi_node_t *root) {
+    jemi_node_t *samples = jemi_array(NULL);
+    jemi_node_t *readings = jemi_array(NULL);
+    int64_t sample = 0;
+
+    add_member(root, "samples", samples);
+    add_member(root, "readings", readings);
+    while (room_for(2)) {
+        sample += rng_range(-1000, 1000);
+        jemi_array_append(samples, jemi_integer(sample));
+        jemi_array_append(readings, jemi_float(rng_double(-50.0, 150.0)));
+    }
+}
+
+static shape_fn_t find_shape(const char *name) {
+    if (strcmp(name, "canada") == 0) {
+        return gen_canada;
+    } else if (strcmp(name, "twitter") == 0) {
+        return gen_twitter;
+    } else if (strcmp(name, "nested") == 0) {
+        return gen_nested;
+    } else if (strcmp(name, "numeric") == 0) {
+        return gen_numeric;
+    }
+    return NULL;
+}
+
+static void write_program(FILE *fp, jemi_node_t *root, const char *args,
+                          size_t n_nodes) {
+    jemi_iter_frame_t stack[MAX_DEPTH];
+    jemi_iter_t it;
+
+    fprintf(fp, "// generated by corpus_gen %s\n", args);
+    fprintf(fp, "// requires a pool of at least %zu nodes\n\n", n_nodes);
+    fprintf(fp, "#include \"jemi.h\"\n\n");
+    fprintf(fp, "jemi_node_t *build_corpus(void) {\n");
+    fprintf(fp, "    jemi_node_t *s[%d];\n", MAX_DEPTH);
+    fprintf(fp, "    jemi_node_t *v;\n\n");
+
+    // s[level] holds the container being filled at each level
+    jemi_iter_init(&it, root, stack, MAX_DEPTH);
+    while (jemi_iter_next(&it) != JEMI_ITER_DONE) {
+        char var[16] = "v"; // the new node
+        if (it.event == JEMI_ITER_LEAVE) {
+            continue;
+        } else if (it.event == JEMI_ITER_ENTER) {
+            snprintf(var, sizeof(var), "s[%zu]", it.level);
+            fprintf(fp, "    %s = %s;\n", var,
+                    it.node->type == JEMI_OBJECT ? "jemi_object(NULL)"
+                                                 : "jemi_array(NULL)");
+            if (it.level == 0) {
+                continue;
+            }
+        } else {
+            fprintf(fp, "    v = ");
+            write_leaf(fp, it.node);
+            fprintf(fp, ";\n");
+        }
+        // add the new node to its container
+        if (it.key) {
+            fprintf(fp, "    jemi_object_append(s[%zu], jemi_list(jemi_string(",
+                    it.level - 1);
+            write_literal(fp, it.key->string, strlen(it.key->string));
+            fprintf(fp, "), %s, NULL));\n", var);
+        } else {
+            fprintf(fp, "    jemi_array_append(s[%zu], %s);\n", it.level - 1,
+                    var);
+        }
+    }
+    fprintf(fp, "    return s[0];\n}\n");
+}
+
+static void write_leaf(FILE *fp, jemi_node_t *node) {
+    switch (node->type) {
+    case JEMI_FLOAT:
+        fprintf(fp, "jemi_float(%.17g)", node->number);
+        break;
+    case JEMI_INTEGER:
+        fprintf(fp, "jemi_integer(%" PRId64 "LL)", node->integer);
+        break;
+    case JEMI_STRING:
+        fprintf(fp, "jemi_string(");
+        write_literal(fp, node->string, strlen(node->string));
+        fprintf(fp, ")");
+        break;
+    case JEMI_TRUE:
+        fprintf(fp, "jemi_true()");
+        break;
+    case JEMI_FALSE:
+        fprintf(fp, "jemi_false()");
+        break;
+    default:
+        fprintf(fp, "jemi_null()");
+        break;
+    }
+}
+
+static void write_literal(FILE *fp, const char *string, size_t len) {
+    fputc('"', fp);
+    for (size_t i = 0; i < len; i++) {
+        if (string[i] == '"' || string[i] == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(string[i], fp);
+    }
+    fputc('"', fp);
+}
+
+static void file_writer_fn(const char *buf, size_t len, void *arg) {
+    fwrite(buf, 1, len, (FILE *)arg);
+}
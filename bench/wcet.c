@@ -0,0 +1,405 @@
+/**
+ * @file wcet.c
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 R. Dunbar Poor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+Measure the worst-case execution time of each jemi emitter on adversarial
+structures: the deepest nesting, the widest object, the longest strings, the
+slowest integer and float values and subtrees spilled out of the pool.  Each structure is emitted many times with
+the data cache flushed before every run, and the slowest run is reported in
+cycles per node and cycles per byte of output.
+
+Cycles come from the time stamp counter on x86, the virtual counter on
+AArch64 and clock_gettime() (in nanoseconds) elsewhere.  On a Cortex-M
+target, replace read_cycles() with a read of DWT->CYCCNT.
+
+To build and run (on a POSIX / gcc style environment):
+
+gcc -O2 -Wall -I.. -o wcet wcet.c ../jemi.c
+./wcet [runs] [max cycles per node]
+
+Add -DJEMI_GENERATIONS to both files to measure jemi_emit_since() as well.
+
+If a maximum is given, the exit status is 1 when any measurement exceeds it,
+so the harness can serve as a regression gate.
+
+*/
+
+// *****************************************************************************
+// Includes
+
+#include "jemi.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// *****************************************************************************
+// Private types and definitions
+
+#define POOL_SIZE 20000
+#define MAX_DEPTH 1000           // nesting of the "deepest" structure
+#define LONG_STRING_LENGTH 4096  // length of each string in "longest strings"
+#define SPILL_SIZE (1024 * 1024)     // storage for "spilled subtrees"
+#define MAX_SLOTS 16                 // numbers rendered into fixed-width slots
+#define FLUSH_SIZE (8 * 1024 * 1024) // larger than the last level cache
+#define DEFAULT_RUNS 20
+
+typedef jemi_node_t *(*build_fn_t)(void);
+
+typedef struct {
+    const char *name;
+    build_fn_t build;
+} shape_t;
+
+typedef struct {
+    const char *name;
+    void (*emit)(jemi_node_t *root);
+} path_t;
+
+// *****************************************************************************
+// Private (static) storage
+
+static jemi_node_t s_pool[POOL_SIZE];
+
+static char s_long_string[LONG_STRING_LENGTH + 1];
+static char s_escaped_string[LONG_STRING_LENGTH + 1];
+
+static char s_spill[SPILL_SIZE];
+static size_t s_spill_size;
+
+static jemi_slot_t s_slots[MAX_SLOTS];
+static size_t s_n_slots;
+
+#ifdef JEMI_GENERATIONS
+static uint32_t s_since; // generation before the structure was built
+#endif
+
+static uint8_t s_flush_buf[FLUSH_SIZE];
+
+static volatile size_t s_bytes; // bytes written by the current run
+static volatile char s_sink;    // keeps the writers from being optimized out
+
+// *****************************************************************************
+// Private (static, forward) declarations
+
+/**
+ * @brief Return the current cycle count.
+ */
+static uint64_t read_cycles(void);
+
+/**
+ * @brief Evict jemi's nodes and other data from the data cache.
+ */
+static void flush_cache(void);
+
+/**
+ * @brief Give (up to MAX_SLOTS of) the numbers among root's children slots.
+ */
+static void find_slots(jemi_node_t *root);
+
+static jemi_node_t *build_deepest(void);
+static jemi_node_t *build_widest(void);
+static jemi_node_t *build_longest_strings(void);
+static jemi_node_t *build_escaped_strings(void);
+static jemi_node_t *build_slowest_integers(void);
+static jemi_node_t *build_slowest_floats(void);
+static jemi_node_t *build_spilled(void);
+
+static void emit_per_char(jemi_node_t *root);
+static void emit_chunked(jemi_node_t *root);
+static void emit_streaming(jemi_node_t *root);
+static void emit_slotted(jemi_node_t *root);
+static void emit_pretty(jemi_node_t *root);
+#ifdef JEMI_GENERATIONS
+static void emit_since(jemi_node_t *root);
+#endif
+
+static void writer_fn(char ch, void *arg);
+static void chunk_writer_fn(const char *buf, size_t len, void *arg);
+static void spill_writer_fn(const char *buf, size_t len, void *arg);
+static size_t spill_reader_fn(size_t offset, size_t len, char *buf,
+                              const char **data, void *arg);
+
+// *****************************************************************************
+// Public code
+
+int main(int argc, char **argv) {
+    static const shape_t shapes[] = {
+        {"deepest", build_deepest},
+        {"widest", build_widest},
+        {"longest strings", build_longest_strings},
+        {"escaped strings", build_escaped_strings},
+        {"slowest integers", build_slowest_integers},
+        {"slowest floats", build_slowest_floats},
+        {"spilled subtrees", build_spilled},
+    };
+    static const path_t paths[] = {
+        {"jemi_emit", emit_per_char},
+        {"jemi_emit_chunked", emit_chunked},
+        {"jemi_sw_node", emit_streaming},
+        {"jemi_emit_slots", emit_slotted},
+        {"jemi_emit_pretty", emit_pretty},
+#ifdef JEMI_GENERATIONS
+        {"jemi_emit_since", emit_since},
+#endif
+    };
+    int runs = (argc > 1) ? atoi(argv[1]) : DEFAULT_RUNS;
+    double limit = (argc > 2) ? atof(argv[2]) : 0.0;
+    bool exceeded = false;
+
+    memset(s_long_string, 'x', LONG_STRING_LENGTH);
+    for (size_t i = 0; i < LONG_STRING_LENGTH; i++) {
+        s_escaped_string[i] = (i & 1) ? '"' : '\n'; // every char is escaped
+    }
+    printf("%-18s %-18s %8s %9s %12s %11s %11s\n", "structure", "emitter",
+           "nodes", "bytes", "max cycles", "cyc/node", "cyc/byte");
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        jemi_node_t *root;
+        size_t n_nodes;
+
+        jemi_init(s_pool, POOL_SIZE);
+#ifdef JEMI_GENERATIONS
+        s_since = jemi_generation(); // everything built after this is "new"
+#endif
+        root = shapes[s].build();
+        n_nodes = POOL_SIZE - jemi_available();
+        find_slots(root);
+
+        for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+            uint64_t worst = 0;
+            for (int run = 0; run < runs; run++) {
+                uint64_t start, elapsed;
+                flush_cache();
+                s_bytes = 0;
+                start = read_cycles();
+                paths[p].emit(root);
+                elapsed = read_cycles() - start;
+                if (elapsed > worst) {
+                    worst = elapsed;
+                }
+            }
+            double per_node = (double)worst / n_nodes;
+            printf("%-18s %-18s %8zu %9zu %12llu %11.1f %11.2f\n",
+                   shapes[s].name, paths[p].name, n_nodes, s_bytes,
+                   (unsigned long long)worst, per_node,
+                   (double)worst / s_bytes);
+            if (limit > 0.0 && per_node > limit) {
+                exceeded = true;
+            }
+        }
+    }
+    return exceeded ? 1 : 0;
+}
+
+// *****************************************************************************
+// Private (static) code
+
+static uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t count;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(count));
+    return count;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static void flush_cache(void) {
+    // touching a buffer larger than the cache evicts everything else
+    for (size_t i = 0; i < FLUSH_SIZE; i += 64) {
+        s_flush_buf[i] += 1;
+    }
+}
+
+static void find_slots(jemi_node_t *root) {
+    s_n_slots = 0;
+    for (jemi_node_t *node = root->children; node && s_n_slots < MAX_SLOTS;
+         node = node->sibling) {
+        if (node->type == JEMI_INTEGER || node->type == JEMI_FLOAT) {
+            s_slots[s_n_slots++] = (jemi_slot_t){.node = node, .width = 21, .pad = ' '};
+        }
+    }
+}
+
+static jemi_node_t *build_deepest(void) {
+    jemi_node_t *root = jemi_array(NULL);
+    jemi_node_t *node = root;
+
+    // alternate arrays and single-member objects
+    for (int depth = 1; depth < MAX_DEPTH; depth++) {
+        jemi_node_t *child = (depth & 1) ? jemi_object(NULL) : jemi_array(NULL);
+        if (node->type == JEMI_OBJECT) {
+            jemi_object_append(node, jemi_list(jemi_string("k"), child, NULL));
+        } else {
+            jemi_array_append(node, child);
+        }
+        node = child;
+    }
+    return root;
+}
+
+static jemi_node_t *build_widest(void) {
+    jemi_node_t *root = jemi_object(NULL);
+
+    while (jemi_available() >= 2) {
+        jemi_object_append(root, jemi_list(jemi_string("key"), jemi_null(), NULL));
+    }
+    return root;
+}
+
+static jemi_node_t *build_longest_strings(void) {
+    jemi_node_t *root = jemi_array(NULL);
+
+    for (int i = 0; i < 64; i++) {
+        jemi_array_append(root, jemi_string(s_long_string));
+    }
+    return root;
+}
+
+static jemi_node_t *build_escaped_strings(void) {
+    jemi_node_t *root = jemi_array(NULL);
+
+    for (int i = 0; i < 64; i++) {
+        jemi_array_append(root, jemi_concat(jemi_string(s_escaped_string), NULL));
+    }
+    return root;
+}
+
+static jemi_node_t *build_slowest_integers(void) {
+    jemi_node_t *root = jemi_array(NULL);
+
+    // the most digits, and a sign
+    while (jemi_available() >= 1) {
+        jemi_array_append(root, jemi_integer(INT64_MIN));
+    }
+    return root;
+}
+
+static jemi_node_t *build_slowest_floats(void) {
+    static const double values[] = {
+        -1.7976931348623157e308,  // the longest text: 318 bytes
+        4.9406564584124654e-324,  // smallest subnormal
+        -2.2250738585072014e-308, // smallest normal
+        -0.1,                     // not exactly representable
+    };
+    jemi_node_t *root = jemi_array(NULL);
+
+    for (size_t i = 0; jemi_available() >= 1; i++) {
+        jemi_array_append(root, jemi_float(values[i % 4]));
+    }
+    return root;
+}
+
+static jemi_node_t *build_spilled(void) {
+    jemi_node_t *root = jemi_array(NULL);
+
+    // objects of slow integers, each spilled as soon as it's built
+    s_spill_size = 0;
+    jemi_spill_init(spill_writer_fn, spill_reader_fn, NULL);
+    for (int i = 0; i < 1024; i++) {
+        jemi_node_t *object = jemi_object(NULL);
+        for (int j = 0; j < 8; j++) {
+            jemi_object_append(object, jemi_list(jemi_string("key"),
+                                                 jemi_integer(INT64_MIN), NULL));
+        }
+        jemi_spill(object);
+        jemi_array_append(root, object);
+    }
+    return root;
+}
+
+static void emit_per_char(jemi_node_t *root) {
+    jemi_emit(root, writer_fn, NULL);
+}
+
+static void emit_chunked(jemi_node_t *root) {
+    jemi_emit_chunked(root, chunk_writer_fn, NULL);
+}
+
+static void emit_streaming(jemi_node_t *root) {
+    jemi_sw_t sw;
+    jemi_sw_init(&sw, chunk_writer_fn, NULL);
+    jemi_sw_node(&sw, root);
+    jemi_sw_flush(&sw);
+}
+
+static void emit_slotted(jemi_node_t *root) {
+    jemi_emit_slots(root, s_slots, s_n_slots, writer_fn, NULL);
+}
+
+static void emit_pretty(jemi_node_t *root) {
+    static const jemi_pretty_t style = {.indent = 2, .indent_char = ' ', .newline = "\n"};
+    jemi_emit_pretty_chunked(root, &style, chunk_writer_fn, NULL);
+}
+
+#ifdef JEMI_GENERATIONS
+static void emit_since(jemi_node_t *root) {
+    jemi_emit_since(root, s_since, writer_fn, NULL);
+}
+#endif
+
+static void writer_fn(char ch, void *arg) {
+    (void)arg;
+    s_sink = ch;
+    s_bytes += 1;
+}
+
+static void chunk_writer_fn(const char *buf, size_t len, void *arg) {
+    (void)arg;
+    s_sink = buf[len - 1];
+    s_bytes += len;
+}
+
+static void spill_writer_fn(const char *buf, size_t len, void *arg) {
+    (void)arg;
+    if (s_spill_size + len <= SPILL_SIZE) {
+        memcpy(&s_spill[s_spill_size], buf, len);
+    }
+    s_spill_size += len;
+}
+
+static size_t spill_reader_fn(size_t offset, size_t len, char *buf,
+                              const char **data, void *arg) {
+    (void)buf;
+    (void)arg;
+    if (offset + len > SPILL_SIZE) {
+        return 0;
+    }
+    *data = &s_spill[offset]; // already in memory: no copy needed
+    return len;
+}
@@ -31,21 +31,197 @@
 #include "jemi.h"
 
 #include <stdarg.h>
+#include <float.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // *****************************************************************************
 // Private types and definitions
 
+#define RESOLVE_BATCH 64 // pointers resolved per walk
+
+// longest number text, "%lf" of -DBL_MAX: sign, 309 digits, point, 6 decimals
+#define NUMBER_SIZE (1 + 309 + 1 + 6 + 1) // ... and a null
+
+// the reference token that a pointer will match next
+typedef struct {
+    const char *token; // not null terminated, or NULL if there are no more
+    size_t len;        // length of token, escapes included
+    bool escaped;      // token contains a "~0" or "~1" escape
+} resolve_cursor_t;
+
+typedef struct {
+    jemi_writer_t writer_fn;      // output a char at a time, or...
+    jemi_chunk_writer_t chunk_fn; // ... in chunks staged in buf
+    void *arg;
+    size_t count;       // number of bytes written so far
+    char *buf;          // JEMI_CHUNK_SIZE bytes of staging for chunk_fn
+    size_t len;         // number of bytes staged in buf
+    jemi_slot_t *slots; // nodes to render into fixed-width slots
+    size_t n_slots;
+    const jemi_pretty_t *pretty; // indentation style, or NULL if compact
+    size_t depth;                // nesting level, for indentation
+} emit_ctx_t;
+
+typedef struct {
+    jemi_chunk_writer_t write_fn; // appends bytes to the spill storage
+    jemi_spill_reader_t read_fn;  // reads them back
+    void *arg;
+    size_t size; // number of bytes in the spill storage
+} spill_store_t;
+
+// CBOR major types (in the top three bits of the initial byte)
+#define CBOR_UINT 0x00
+#define CBOR_NEGINT 0x20
+#define CBOR_TEXT 0x60
+#define CBOR_ARRAY 0x80
+#define CBOR_MAP 0xa0
+#define CBOR_TAG 0xc0
+#define CBOR_SIMPLE 0xe0
+
+// CBOR initial bytes with special meanings
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+#define CBOR_INDEFINITE 0x1f // additional info for indefinite length
+#define CBOR_BREAK 0xff
+
+// an array or map being decoded by jemi_parse_cbor()
+typedef struct {
+    jemi_node_t *container;
+    jemi_node_t *last;  // most recently added child
+    uint64_t remaining; // number of items still to come (unless indefinite)
+    bool indefinite;    // ends with CBOR_BREAK rather than after n items
+    bool is_map;        // items alternate between keys and values
+} cbor_frame_t;
+
+// what jemi_json_to_cbor() expects next
+typedef enum {
+    JSON_VALUE,        // any value
+    JSON_ARRAY_START,  // a value or ']'
+    JSON_OBJECT_START, // a key or '}'
+    JSON_KEY,          // a key
+    JSON_COLON,        // ':' between key and value
+    JSON_NEXT,         // ',' or the end of the enclosing container
+    JSON_DONE,         // nothing (but whitespace)
+} json_state_t;
+
+// bits of jemi_sw_t.state[]
+#define SW_OBJECT 0x01   // level is an object
+#define SW_NONEMPTY 0x02 // level has at least one element
+#define SW_KEY 0x04      // a key has been written, its value has not
+
+typedef enum {
+    QOP_MEMBER,   // select the member named key
+    QOP_INDEX,    // select the element at index
+    QOP_WILDCARD, // select every member or element
+    QOP_DESCEND,  // apply the next op to this node and all its descendants
+    QOP_FILTER,   // select members or elements that pass the filter
+} query_opcode_t;
+
+typedef enum {
+    QCMP_EXISTS,
+    QCMP_EQ,
+    QCMP_NE,
+    QCMP_LT,
+    QCMP_LE,
+    QCMP_GT,
+    QCMP_GE,
+} query_compare_t;
+
+typedef struct {
+    jemi_node_t *cursor; // next child to visit
+    uint8_t pc;          // index of the op being applied to the children
+    bool is_obj;         // true if iterating over an object's children
+} query_frame_t;
+
+typedef struct {
+    const jemi_query_t *query;
+    jemi_match_fn_t match_fn;
+    void *arg;
+    int matches;
+    bool overflow;
+    size_t sp;
+    query_frame_t stack[JEMI_QUERY_MAX_DEPTH];
+} query_ctx_t;
+
+typedef enum {
+    SOP_END,        // end of a (sub)schema
+    SOP_TYPE,       // the value's type must be one of types
+    SOP_ENUM,       // the value must equal an element of node
+    SOP_MINIMUM,    // numbers must be >= number
+    SOP_MAXIMUM,    // numbers must be <= number
+    SOP_MAX_LENGTH, // strings must have at most length code points
+    SOP_REQUIRED,   // objects must have a member named node
+    SOP_PROPERTY,   // the member named node must satisfy the next subschema
+    SOP_ITEMS,      // every element must satisfy the next subschema
+} schema_opcode_t;
+
+// bits of jemi_schema_op_t.types
+#define STYPE_NULL 0x01
+#define STYPE_BOOLEAN 0x02
+#define STYPE_OBJECT 0x04
+#define STYPE_ARRAY 0x08
+#define STYPE_NUMBER 0x10
+#define STYPE_STRING 0x20
+#define STYPE_INTEGER 0x40
+
+// a subschema being applied by jemi_schema_validate()
+typedef struct {
+    jemi_node_t *instance; // value being validated by the enclosing schema
+    jemi_node_t *cursor;   // for SOP_ITEMS: the next element to validate
+    uint16_t start;        // first op of the subschema
+    uint16_t resume;       // op following the subschema
+} schema_frame_t;
+
+typedef enum { PERSIST_SET, PERSIST_APPEND, PERSIST_REMOVE } persist_op_t;
+
+typedef enum {
+    PERSIST_NOT_FOUND, // target not (yet) found
+    PERSIST_DONE,      // target found, new version built
+    PERSIST_FAILED,    // target found, but ran out of nodes
+} persist_status_t;
+
 // *****************************************************************************
 // Private (static) storage
 
+// "00" through "99", for converting integers two digits at a time
+static const char s_digit_pairs[] = "00010203040506070809"
+                                    "10111213141516171819"
+                                    "20212223242526272829"
+                                    "30313233343536373839"
+                                    "40414243444546474849"
+                                    "50515253545556575859"
+                                    "60616263646566676869"
+                                    "70717273747576777879"
+                                    "80818283848586878889"
+                                    "90919293949596979899";
+
 jemi_node_t *s_jemi_pool;     // user supplied block of nodes
 size_t s_jemi_pool_size;      // number of user-supplied nodes
 jemi_node_t *s_jemi_freelist; // next available node (or null if empty)
 
+static spill_store_t s_jemi_spill; // see jemi_spill_init()
+
+// indentation is written in runs sliced from these
+#define INDENT_RUN 32
+static const char s_indent_spaces[INDENT_RUN + 1] = "                                ";
+static const char s_indent_tabs[INDENT_RUN + 1] =
+    "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+static const jemi_pretty_t s_pretty_default = {
+    .indent = 2, .indent_char = ' ', .newline = "\n"};
+
+#ifdef JEMI_GENERATIONS
+static uint32_t s_jemi_generation; // stamped on nodes as they change
+#endif
+
 // *****************************************************************************
 // Private (static, forward) declarations
 
@@ -55,22 +231,457 @@ jemi_node_t *s_jemi_freelist; // next available node (or null if empty)
  */
 static jemi_node_t *jemi_alloc(jemi_type_t type);
 
+/**
+ * @brief Pop one element from the given freelist, as for jemi_alloc().
+ */
+static jemi_node_t *pop_node(jemi_node_t **freelist, jemi_type_t type);
+
+/**
+ * @brief Take n nodes from the freelist, still linked through their sibling
+ * fields.  If fewer than n nodes are available, take none and return NULL.
+ */
+static jemi_node_t *jemi_alloc_n(size_t n);
+
+/**
+ * @brief Create an array of n values of the given type in one allocation.
+ */
+static jemi_node_t *array_from(jemi_type_t type, const void *values,
+                               size_t n);
+
+/**
+ * @brief Create an object from n keys and either n existing nodes or n values
+ * of the given type, in one allocation.
+ */
+static jemi_node_t *object_from(const char *const *keys,
+                                jemi_node_t *const *nodes, jemi_type_t type,
+                                const void *values, size_t n);
+
+/**
+ * @brief Set the type of a newly allocated node (and with JEMI_GENERATIONS,
+ * its parent and generation).
+ */
+static void init_node(jemi_node_t *node, jemi_type_t type,
+                      jemi_node_t *parent);
+
+/**
+ * @brief Set node to values[i], where values is a C array of the given type.
+ */
+static void set_value(jemi_node_t *node, jemi_type_t type, const void *values,
+                      size_t i);
+
+/**
+ * @brief Record list as (additional) children of parent: add them to parent's
+ * child count and, with JEMI_GENERATIONS, point them back at parent.
+ */
+static void adopt(jemi_node_t *parent, jemi_node_t *list);
+
+/**
+ * @brief Stamp node and its ancestors with the current generation (with
+ * JEMI_GENERATIONS).
+ */
+static void touch(jemi_node_t *node);
+
+/**
+ * @brief Stamp each node of list (but not its children) with the current
+ * generation (with JEMI_GENERATIONS), so members attached late are reported.
+ */
+static void stamp_list(jemi_node_t *list);
+
+#ifdef JEMI_GENERATIONS
+/**
+ * @brief Print the members of an object that changed after generation.
+ */
+static void emit_changed(emit_ctx_t *ctx, jemi_node_t *object,
+                         uint32_t generation);
+#endif
+
+/**
+ * @brief Release every node in list (and their children) back to the pool.
+ */
+static void free_list(jemi_node_t *list);
+
+/**
+ * @brief Add node and its descendants at the given depth to *footprint.
+ */
+static void footprint_aux(jemi_node_t *node, size_t depth,
+                          jemi_footprint_t *footprint);
+
+/**
+ * @brief Mark node, its descendants and the targets of references as
+ * JEMI_POOL_LIVE in states.
+ */
+static void mark_live(jemi_node_t *node, jemi_pool_state_t *states);
+
 /**
  * @brief Print a node or a list of nodes.
  */
-static void emit_aux(jemi_node_t *root, jemi_writer_t writer_fn, void *arg,
-                     bool is_obj);
+static void emit_aux(emit_ctx_t *ctx, jemi_node_t *root, bool is_obj);
+
+/**
+ * @brief Print a single node (and its children, but not its siblings).
+ */
+static void emit_node(emit_ctx_t *ctx, jemi_node_t *node);
+
+/**
+ * @brief Start a new line, indented for the current nesting level.
+ */
+static void emit_indent(emit_ctx_t *ctx);
+
+/**
+ * @brief Print a JEMI_FLOAT or JEMI_INTEGER node.  Kept out of emit_node(), so
+ * that its buffer isn't on the stack at every level of nesting.
+ */
+static void emit_number(emit_ctx_t *ctx, jemi_node_t *node);
+
+/**
+ * @brief Print a JEMI_FLOAT or JEMI_INTEGER node into its slot.
+ */
+static void emit_slot(emit_ctx_t *ctx, jemi_slot_t *slot);
+
+/**
+ * @brief Format a JEMI_FLOAT or JEMI_INTEGER node into buf, which must hold at
+ * least NUMBER_SIZE bytes.  Returns the length of the (null terminated) result.
+ */
+static size_t format_number(jemi_node_t *node, char *buf, size_t size);
+
+/**
+ * @brief Format an integer into buf, which must hold at least 21 bytes.
+ * Returns the length of the result, which is not null terminated.
+ */
+static size_t format_int64(char *buf, int64_t value);
+
+/**
+ * @brief Format an unsigned integer into buf, which must hold at least 20
+ * bytes.  Returns the length of the result, which is not null terminated.
+ */
+static size_t format_uint64(char *buf, uint64_t value);
+
+/**
+ * @brief Return the value of a JEMI_INTEGER node (which may hold a uint64_t,
+ * see jemi_node_t) as a double.
+ */
+static double integer_value(const jemi_node_t *node);
+
+/**
+ * @brief Make a copy of a node and its siblings, taking nodes from freelist.
+ */
+static jemi_node_t *copy_list(jemi_node_t **freelist, jemi_node_t *root);
 
 /**
  * @brief Make a copy of a node and its contents, including children nodes,
- * but not siblings.
+ * but not siblings, taking nodes from freelist.
+ */
+static jemi_node_t *copy_node(jemi_node_t **freelist, jemi_node_t *node);
+
+/**
+ * @brief Return the number of nodes copy_list() takes to copy list.
+ */
+static size_t list_size(jemi_node_t *list);
+
+/**
+ * @brief Apply patch to target as jemi_merge_patch() does, once the pool is
+ * known to hold enough nodes.
+ */
+static jemi_node_t *merge_patch(jemi_node_t *target, jemi_node_t *patch);
+
+/**
+ * @brief Return (at most) the number of nodes merge_patch() will allocate to
+ * apply patch to target.
+ */
+static size_t patch_cost(jemi_node_t *target, jemi_node_t *patch);
+
+/**
+ * @brief Fold a node and its contents (but not siblings) into a hash.
+ */
+static uint32_t hash_node(uint32_t hash, jemi_node_t *node);
+
+/**
+ * @brief Fold n bytes into an FNV-1a hash.
+ */
+static uint32_t hash_bytes(uint32_t hash, const void *bytes, size_t n);
+
+/**
+ * @brief Write a CBOR initial byte and argument in the shortest form.
+ */
+static void cbor_head(emit_ctx_t *ctx, uint8_t major, uint64_t value);
+
+/**
+ * @brief Write a CBOR float, in single precision if that's exact.
+ */
+static void cbor_float(emit_ctx_t *ctx, double value);
+
+/**
+ * @brief Write the JSON string starting after the opening quote at *p as a
+ * CBOR text string.  Advances *p past the closing quote and returns false if
+ * malformed.
+ */
+static bool json_text(emit_ctx_t *ctx, const char **p, const char *end);
+
+/**
+ * @brief Read the argument of a CBOR item with the given additional info at
+ * *p into *value, advancing *p.  Returns false if malformed or truncated.
+ */
+static bool cbor_argument(const uint8_t **p, const uint8_t *end, uint8_t info,
+                          uint64_t *value);
+
+/**
+ * @brief Decode CBOR into a structure at *root, or if root is NULL, only
+ * validate it.  Returns the number of nodes decoded, or 0 on failure.
+ */
+static size_t cbor_decode(const uint8_t *buf, size_t len, jemi_node_t **root);
+
+/**
+ * @brief Decode the scalar CBOR item with the given major type, additional
+ * info and argument into node, advancing *p past any content.  Returns false
+ * if unsupported or malformed.
+ */
+static bool cbor_scalar(const uint8_t **p, const uint8_t *end, uint8_t major,
+                        uint8_t info, uint64_t value, jemi_node_t *node);
+
+/**
+ * @brief Convert an IEEE 754 half precision value to a float.
+ */
+static float half_to_float(uint16_t half);
+
+/**
+ * @brief Decode the JSON string starting after the opening quote at *p,
+ * writing its bytes to ctx (unless ctx is NULL).  Sets *len to the decoded
+ * length and advances *p past the closing quote.  Returns false if malformed.
+ */
+static bool json_string(emit_ctx_t *ctx, const char **p, const char *end,
+                        size_t *len);
+
+/**
+ * @brief Parse the JSON number at *p and write it as CBOR.  Advances *p and
+ * returns false if malformed or too large for a double.
+ */
+static bool json_number(emit_ctx_t *ctx, const char **p, const char *end);
+
+/**
+ * @brief Convert the (well-formed) JSON number in [p, end) to a double, for a
+ * number at the very end of the input, where strtod() can't be used in place.
+ */
+static double json_number_tail(const char *p, const char *end);
+
+/**
+ * @brief Parse the JSON literal (true, false or null) at *p and write it as
+ * CBOR.  Advances *p and returns false if malformed.
+ */
+static bool json_literal(emit_ctx_t *ctx, const char **p, const char *end);
+
+/**
+ * @brief Parse four hex digits at p into *value.  Returns false if malformed.
+ */
+static bool json_hex4(const char *p, const char *end, uint32_t *value);
+
+/**
+ * @brief Encode a Unicode code point as UTF-8 into buf (which must hold at
+ * least 4 bytes).  Returns the number of bytes.
+ */
+static size_t utf8_encode(char *buf, uint32_t code_point);
+
+/**
+ * @brief Return the node that node refers to if it's a JEMI_REF, else node.
+ */
+static jemi_node_t *deref(jemi_node_t *node);
+
+/**
+ * @brief Return the length of a JEMI_STRING node's string.
+ */
+static size_t string_length(const jemi_node_t *node);
+
+/**
+ * @brief Return true if the string of a JEMI_STRING node equals the first len
+ * chars of text.
+ */
+static bool string_equals(const jemi_node_t *node, const char *text,
+                          size_t len);
+
+/**
+ * @brief Return the value of the member of object whose key equals the first
+ * len chars of key, or NULL if there is no such member.
+ */
+static jemi_node_t *find_member(jemi_node_t *object, const char *key,
+                                size_t len);
+
+/**
+ * @brief Parse a quoted string, name or filter at *path into op.  Updates
+ * *path and returns false if malformed.
+ */
+static bool compile_name(jemi_query_op_t *op, const char **path, char quote);
+static bool compile_filter(jemi_query_op_t *op, const char **path);
+
+/**
+ * @brief Apply the query from pc onwards to node, either reporting a match or
+ * pushing a frame for iterating over the node's children.
+ */
+static void query_visit(query_ctx_t *ctx, jemi_node_t *node, uint8_t pc);
+
+/**
+ * @brief Return true if node passes the filter op.
+ */
+static bool query_filter(const jemi_query_op_t *op, jemi_node_t *node);
+
+/**
+ * @brief Append an op to schema, or return NULL if it is full.
+ */
+static jemi_schema_op_t *schema_op(jemi_schema_t *schema, uint8_t opcode);
+
+/**
+ * @brief Compile the (sub)schema at node into ops ending with SOP_END.
+ */
+static bool schema_compile_aux(jemi_schema_t *schema, jemi_node_t *node,
+                               size_t depth);
+
+/**
+ * @brief Return the STYPE_xxx bit for a JSON Schema type name, or 0 if unknown.
+ */
+static uint8_t schema_type_bit(jemi_node_t *name);
+
+/**
+ * @brief Return the STYPE_xxx bits of the types that node belongs to.
+ */
+static uint8_t schema_types_of(jemi_node_t *node);
+
+/**
+ * @brief Return true if node passes op (any op but SOP_END, SOP_PROPERTY and
+ * SOP_ITEMS).
+ */
+static bool schema_check(const jemi_schema_op_t *op, jemi_node_t *node);
+
+/**
+ * @brief Make a copy of a single node, sharing its children (if any).  The
+ * sibling field of the copy is NULL.
+ */
+static jemi_node_t *clone_node(jemi_node_t *node);
+
+/**
+ * @brief Shallow copy a node on the path to a change, stamping the copy with
+ * the current generation so that jemi_emit_since() reports the change.
+ */
+static jemi_node_t *clone_changed(jemi_node_t *node);
+
+/**
+ * @brief Shallow copy the nodes of list up to (but not including) stop, and
+ * link the last copied node to tail.  Returns the head of the new list.
+ */
+static jemi_node_t *clone_prefix(jemi_node_t *list, jemi_node_t *stop,
+                                 jemi_node_t *tail);
+
+/**
+ * @brief Return the number of nodes persist_list() will allocate to apply op
+ * to target, and set *found if target is in list (or its children).
  */
-static jemi_node_t *copy_node(jemi_node_t *node);
+static size_t persist_cost(jemi_node_t *list, bool is_obj,
+                           jemi_node_t *target, persist_op_t op, bool *found);
+
+/**
+ * @brief Apply op to target by path copying, or return NULL (allocating
+ * nothing) if target isn't in root or the pool is too low to finish.
+ */
+static jemi_node_t *persist(jemi_node_t *root, jemi_node_t *target,
+                            persist_op_t op, jemi_node_t *value);
+
+/**
+ * @brief Return true if at least n nodes are available.
+ */
+static bool pool_has(size_t n);
+
+/**
+ * @brief Search list (and its children) for target and apply op by path
+ * copying.  Returns the new list if *status is set to PERSIST_DONE.
+ */
+static jemi_node_t *persist_list(jemi_node_t *list, bool is_obj,
+                                 jemi_node_t *target, persist_op_t op,
+                                 jemi_node_t *value, persist_status_t *status);
+
+/**
+ * @brief Return true if the (escaped) reference token matches key.
+ */
+static bool token_matches_key(const char *token, const char *key,
+                              size_t len);
+
+/**
+ * @brief Return true if the reference token is the decimal form of index.
+ */
+static bool token_matches_index(const char *token, size_t index);
+
+/**
+ * @brief Return the child of container designated by token, or NULL.
+ */
+static jemi_node_t *pointer_step(jemi_node_t *container, const char *token);
+
+/**
+ * @brief Advance every handle that currently refers to container to the child
+ * matching its next reference token, recursing into matched children.  Handles
+ * that can't advance any further are set to NULL.
+ */
+static void resolve_many_aux(jemi_node_t *container, resolve_cursor_t *cursors,
+                             jemi_node_t **handles, size_t n_pointers);
+
+/**
+ * @brief Point cursor at the reference token starting at token.
+ */
+static void resolve_cursor_set(resolve_cursor_t *cursor, const char *token);
+
+/**
+ * @brief Write a char to the writer_fn.
+ */
+static void emit_char(emit_ctx_t *ctx, char ch);
+
+/**
+ * @brief Write len chars to the writer_fn.
+ */
+static void emit_chars(emit_ctx_t *ctx, const char *buf, size_t len);
+
+/**
+ * @brief Pass the chars staged in ctx->buf to the chunk_fn.
+ */
+static void emit_flush(emit_ctx_t *ctx);
+
+/**
+ * @brief Return an emit context that stages output in the buffer of a
+ * streaming writer.
+ */
+static emit_ctx_t sw_ctx(jemi_sw_t *sw);
+
+/**
+ * @brief Write the comma that precedes a value in a streaming writer and
+ * return an emit context for writing the value.
+ */
+static emit_ctx_t sw_begin_value(jemi_sw_t *sw);
+
+/**
+ * @brief Note that a value has been written in a streaming writer, and flush
+ * the output if it completed a top-level value.
+ */
+static void sw_end_value(jemi_sw_t *sw, emit_ctx_t *ctx);
+
+/**
+ * @brief Open an object or array (or, past the maximum depth, write null and
+ * skip its contents).
+ */
+static void sw_begin_container(jemi_sw_t *sw, char ch, uint8_t state);
 
 /**
  * @brief Write a string to the writer_fn, a byte at a time.
  */
-static void emit_string(jemi_writer_t writer_fn, void *arg, const char *buf);
+static void emit_string(emit_ctx_t *ctx, const char *buf);
+
+/**
+ * @brief Write the contents of a JSON string, escaping characters as needed.
+ */
+static void emit_escaped(emit_ctx_t *ctx, const char *buf, size_t len);
+
+/**
+ * @brief Write the parts of a JEMI_CONCAT node (without the enclosing quotes).
+ */
+static void emit_concat(emit_ctx_t *ctx, jemi_node_t *parts);
+
+/**
+ * @brief Write the bytes of a JEMI_SPILLED node, read back from spill storage.
+ */
+static void emit_spilled(emit_ctx_t *ctx, jemi_node_t *node);
 
 // *****************************************************************************
 // Public code
@@ -93,16 +704,34 @@ void jemi_reset(void) {
     s_jemi_freelist = next; // reset head of the freelist
 }
 
+void jemi_free(jemi_node_t *node) {
+    if (node == NULL) {
+        return;
+    }
+    if (node->type == JEMI_ARRAY || node->type == JEMI_OBJECT ||
+        node->type == JEMI_CONCAT) {
+        free_list(node->children);
+    }
+    // push node onto the freelist
+    node->sibling = s_jemi_freelist;
+    s_jemi_freelist = node;
+}
+
 jemi_node_t *jemi_array(jemi_node_t *element, ...) {
     va_list ap;
     jemi_node_t *root = jemi_alloc(JEMI_ARRAY);
 
+    if (root == NULL) {
+        return NULL; // out of nodes
+    }
     va_start(ap, element);
     root->children = element;
     while (element != NULL) {
         element->sibling = va_arg(ap, jemi_node_t *);
         element = element->sibling;
     }
+    va_end(ap);
+    adopt(root, root->children);
     return root;
 }
 
@@ -110,12 +739,17 @@ jemi_node_t *jemi_object(jemi_node_t *element, ...) {
     va_list ap;
     jemi_node_t *root = jemi_alloc(JEMI_OBJECT);
 
+    if (root == NULL) {
+        return NULL; // out of nodes
+    }
     va_start(ap, element);
     root->children = element;
     while (element != NULL) {
         element->sibling = va_arg(ap, jemi_node_t *);
         element = element->sibling;
     }
+    va_end(ap);
+    adopt(root, root->children);
     return root;
 }
 
@@ -128,12 +762,36 @@ jemi_node_t *jemi_list(jemi_node_t *element, ...) {
         element->sibling = va_arg(ap, jemi_node_t *);
         element = element->sibling;
     }
+    va_end(ap);
     return first;
 }
 
-jemi_node_t *jemi_float(double value) {
-    jemi_node_t *node = jemi_alloc(JEMI_FLOAT);
-    if (node) {
+jemi_node_t *jemi_array_from_ints(const int64_t *values, size_t n) {
+    return array_from(JEMI_INTEGER, values, n);
+}
+
+jemi_node_t *jemi_array_from_floats(const double *values, size_t n) {
+    return array_from(JEMI_FLOAT, values, n);
+}
+
+jemi_node_t *jemi_array_from_strings(const char *const *values, size_t n) {
+    return array_from(JEMI_STRING, values, n);
+}
+
+jemi_node_t *jemi_object_from_table(const char *const *keys,
+                                    jemi_node_t *const *values, size_t n) {
+    return object_from(keys, values, JEMI_NULL, NULL, n);
+}
+
+jemi_node_t *jemi_object_from_column(const char *const *keys,
+                                     jemi_type_t type, const void *values,
+                                     size_t n) {
+    return object_from(keys, NULL, type, values, n);
+}
+
+jemi_node_t *jemi_float(double value) {
+    jemi_node_t *node = jemi_alloc(JEMI_FLOAT);
+    if (node) {
         node->number = value;
     }
     return node;
@@ -151,10 +809,44 @@ jemi_node_t *jemi_string(const char *string) {
     jemi_node_t *node = jemi_alloc(JEMI_STRING);
     if (node) {
         node->string = string;
+        touch(node);
+    }
+    return node;
+}
+
+jemi_node_t *jemi_string_n(const char *string, size_t len) {
+    jemi_node_t *node;
+    if (len >= JEMI_STRING_MAX_LENGTH) {
+        return NULL; // length won't fit in the node
+    }
+    if ((node = jemi_alloc(JEMI_STRING)) != NULL) {
+        // an empty string can't be told apart from a null terminated one
+        node->string = (len > 0) ? string : "";
+        node->length = len;
+        touch(node);
     }
     return node;
 }
 
+jemi_node_t *jemi_concat(jemi_node_t *part, ...) {
+    va_list ap;
+    jemi_node_t *root = jemi_alloc(JEMI_CONCAT);
+
+    if (root == NULL) {
+        return NULL; // out of nodes
+    }
+    va_start(ap, part);
+    root->children = part;
+    while (part != NULL) {
+        part->sibling = va_arg(ap, jemi_node_t *);
+        part = part->sibling;
+    }
+    va_end(ap);
+    adopt(root, root->children);
+    touch(root);
+    return root;
+}
+
 jemi_node_t *jemi_bool(bool boolean) {
     if (boolean) {
         return jemi_true();
@@ -169,28 +861,96 @@ jemi_node_t *jemi_false(void) { return jemi_alloc(JEMI_FALSE); }
 
 jemi_node_t *jemi_null(void) { return jemi_alloc(JEMI_NULL); }
 
+jemi_node_t *jemi_ref(jemi_node_t *node) {
+    jemi_node_t *ref = jemi_alloc(JEMI_REF);
+    if (ref) {
+        ref->ref = node;
+    }
+    return ref;
+}
+
 jemi_node_t *jemi_copy(jemi_node_t *root) {
-    jemi_node_t *r2 = NULL;
-    jemi_node_t *prev = NULL;
-    jemi_node_t *node;
+    return copy_list(&s_jemi_freelist, root);
+}
 
-    while ((node = copy_node(root)) != NULL) {
-        if (r2 == NULL) {
-            // first time through the loop: save pointer to first element
-            r2 = node;
-        }
-        if (prev != NULL) {
-            prev->sibling = node;
+bool jemi_subpool_init(jemi_subpool_t *sub, size_t n) {
+    sub->freelist = jemi_alloc_n(n);
+    return sub->freelist != NULL || n == 0;
+}
+
+jemi_node_t *jemi_subpool_copy(jemi_subpool_t *sub, jemi_node_t *root) {
+    return copy_list(&sub->freelist, root);
+}
+
+void jemi_subpool_release(jemi_subpool_t *sub) {
+    while (sub->freelist) {
+        jemi_node_t *node = sub->freelist;
+        sub->freelist = node->sibling;
+        node->sibling = s_jemi_freelist;
+        s_jemi_freelist = node;
+    }
+}
+
+uint32_t jemi_hash(jemi_node_t *node) {
+    return hash_node(2166136261u, node); // FNV-1a offset basis
+}
+
+bool jemi_equal(jemi_node_t *a, jemi_node_t *b) {
+    a = deref(a);
+    b = deref(b);
+    if (a == b) {
+        return true;
+    } else if (a == NULL || b == NULL || a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+    case JEMI_ARRAY:
+    case JEMI_OBJECT:
+    case JEMI_CONCAT: {
+        jemi_node_t *ca = a->children;
+        jemi_node_t *cb = b->children;
+        // walk the children rather than trust the cached counts
+        while (ca && cb) {
+            if (!jemi_equal(ca, cb)) {
+                return false;
+            }
+            ca = ca->sibling;
+            cb = cb->sibling;
         }
-        prev = node;
-        root = root->sibling;
+        return ca == cb; // both lists ended together?
     }
-    return r2;
+    case JEMI_FLOAT:
+        return a->number == b->number;
+    case JEMI_INTEGER:
+        return a->integer == b->integer && a->length == b->length;
+    case JEMI_STRING:
+        return string_equals(a, b->string, string_length(b));
+    case JEMI_SPILLED:
+        return a->spill.offset == b->spill.offset &&
+               a->spill.length == b->spill.length;
+    default:
+        return true;
+    }
+}
+
+size_t jemi_length(jemi_node_t *node) {
+    node = deref(node);
+    if (node == NULL) {
+        return 0;
+    } else if (node->type == JEMI_ARRAY) {
+        return node->length;
+    } else if (node->type == JEMI_OBJECT) {
+        return node->length / 2;
+    }
+    return 0;
 }
 
 jemi_node_t *jemi_array_append(jemi_node_t *array, jemi_node_t *items) {
     if (array) {
         array->children = jemi_list_append(array->children, items);
+        adopt(array, items);
+        stamp_list(items);
+        touch(array);
     }
     return array;
 }
@@ -198,6 +958,9 @@ jemi_node_t *jemi_array_append(jemi_node_t *array, jemi_node_t *items) {
 jemi_node_t *jemi_object_append(jemi_node_t *object, jemi_node_t *items) {
     if (object) {
         object->children = jemi_list_append(object->children, items);
+        adopt(object, items);
+        stamp_list(items);
+        touch(object);
     }
     return object;
 }
@@ -205,8 +968,11 @@ jemi_node_t *jemi_object_append(jemi_node_t *object, jemi_node_t *items) {
 jemi_node_t *jemi_object_add_keyval(jemi_node_t *object, const char *key,
                                     jemi_node_t *value) {
     if (object) {
-        object->children = jemi_list_append(
-            object->children, jemi_list(jemi_string(key), value, NULL));
+        jemi_node_t *items = jemi_list(jemi_string(key), value, NULL);
+        object->children = jemi_list_append(object->children, items);
+        adopt(object, items);
+        stamp_list(items);
+        touch(object);
     }
     return object;
 }
@@ -230,9 +996,24 @@ jemi_node_t *jemi_list_append(jemi_node_t *list, jemi_node_t *items) {
     }
 }
 
+jemi_node_t *jemi_merge_patch(jemi_node_t *target, jemi_node_t *patch) {
+    jemi_node_t *result;
+
+    if ((patch = deref(patch)) == NULL) {
+        return target; // nothing to apply
+    }
+    // check up front, so a low pool can't leave target half patched
+    if (!pool_has(patch_cost(target, patch))) {
+        return NULL;
+    }
+    result = merge_patch(target, patch);
+    return target ? target : result; // a ref in target is returned as is
+}
+
 jemi_node_t *jemi_float_set(jemi_node_t *node, double number) {
     if (node) {
         node->number = number;
+        touch(node);
     }
     return node;
 }
@@ -240,6 +1021,8 @@ jemi_node_t *jemi_float_set(jemi_node_t *node, double number) {
 jemi_node_t *jemi_integer_set(jemi_node_t *node, int64_t integer) {
     if (node) {
         node->integer = integer;
+        node->length = 0; // no longer a uint64_t (if it was)
+        touch(node);
     }
     return node;
 }
@@ -252,6 +1035,8 @@ jemi_node_t *jemi_integer_set(jemi_node_t *node, int64_t integer) {
 jemi_node_t *jemi_string_set(jemi_node_t *node, const char *string) {
     if (node) {
         node->string = string;
+        node->length = 0;
+        touch(node);
     }
     return node;
 }
@@ -262,135 +1047,2822 @@ jemi_node_t *jemi_string_set(jemi_node_t *node, const char *string) {
 jemi_node_t *jemi_bool_set(jemi_node_t *node, bool boolean) {
     if (node) {
         node->type = boolean ? JEMI_TRUE : JEMI_FALSE;
+        touch(node);
     }
     return node;
 }
 
-void jemi_emit(jemi_node_t *root, jemi_writer_t writer_fn, void *arg) {
-    emit_aux(root, writer_fn, arg, false);
-    writer_fn('\0', arg);
+void jemi_sw_init(jemi_sw_t *sw, jemi_chunk_writer_t chunk_fn, void *arg) {
+    sw->chunk_fn = chunk_fn;
+    sw->arg = arg;
+    sw->depth = 0;
+    sw->state[0] = 0; // top level: a list of values
+    sw->len = 0;
+    sw->skip = 0;
+    sw->truncated = false;
 }
 
-size_t jemi_available(void) {
-    size_t count = 0;
+void jemi_sw_begin_object(jemi_sw_t *sw) {
+    sw_begin_container(sw, '{', SW_OBJECT);
+}
 
-    jemi_node_t *node = s_jemi_freelist;
-    while (node) {
-        count += 1;
-        node = node->sibling;
+void jemi_sw_begin_array(jemi_sw_t *sw) {
+    sw_begin_container(sw, '[', 0);
+}
+
+void jemi_sw_end(jemi_sw_t *sw) {
+    emit_ctx_t ctx = sw_ctx(sw);
+
+    if (sw->skip > 0) {
+        sw->skip -= 1;
+    } else if (sw->depth > 0) {
+        emit_char(&ctx, (sw->state[sw->depth--] & SW_OBJECT) ? '}' : ']');
+        sw_end_value(sw, &ctx);
     }
-    return count;
 }
 
-// *****************************************************************************
-// Private (static) code
+void jemi_sw_key(jemi_sw_t *sw, const char *key) {
+    emit_ctx_t ctx;
 
-static jemi_node_t *jemi_alloc(jemi_type_t type) {
-    // pop one node from the freelist
-    jemi_node_t *node = s_jemi_freelist;
-    if (node) {
-        s_jemi_freelist = node->sibling;
-        node->sibling = NULL;
-        node->type = type;
+    if (sw->skip > 0) {
+        return;
     }
-    return node;
+    ctx = sw_begin_value(sw);
+    emit_char(&ctx, '"');
+    emit_string(&ctx, key);
+    emit_chars(&ctx, "\":", 2);
+    sw->len = ctx.len;
+    sw->state[sw->depth] |= SW_KEY;
 }
 
-static void emit_aux(jemi_node_t *root, jemi_writer_t writer_fn, void *arg,
-                     bool is_obj) {
-    int count = 0;
+void jemi_sw_int(jemi_sw_t *sw, int64_t value) {
+    jemi_node_t node = {.type = JEMI_INTEGER, .integer = value};
+    jemi_sw_node(sw, &node);
+}
+
+void jemi_sw_float(jemi_sw_t *sw, double value) {
+    jemi_node_t node = {.type = JEMI_FLOAT, .number = value};
+    jemi_sw_node(sw, &node);
+}
+
+void jemi_sw_string(jemi_sw_t *sw, const char *string) {
+    jemi_node_t node = {.type = JEMI_STRING, .string = string};
+    jemi_sw_node(sw, &node);
+}
+
+void jemi_sw_bool(jemi_sw_t *sw, bool boolean) {
+    jemi_node_t node = {.type = boolean ? JEMI_TRUE : JEMI_FALSE};
+    jemi_sw_node(sw, &node);
+}
+
+void jemi_sw_null(jemi_sw_t *sw) {
+    jemi_node_t node = {.type = JEMI_NULL};
+    jemi_sw_node(sw, &node);
+}
+
+void jemi_sw_node(jemi_sw_t *sw, jemi_node_t *node) {
+    emit_ctx_t ctx;
+
+    if (sw->skip > 0) {
+        return;
+    }
+    ctx = sw_begin_value(sw);
+    emit_node(&ctx, node);
+    sw_end_value(sw, &ctx);
+}
+
+void jemi_sw_flush(jemi_sw_t *sw) {
+    emit_ctx_t ctx = sw_ctx(sw);
+    emit_flush(&ctx);
+    sw->len = 0;
+}
+
+bool jemi_sw_truncated(const jemi_sw_t *sw) {
+    return sw->truncated;
+}
+
+bool jemi_json_to_cbor(const char *json, size_t len,
+                       jemi_chunk_writer_t chunk_fn, void *arg) {
+    char buf[JEMI_CHUNK_SIZE];
+    emit_ctx_t ctx = {.chunk_fn = chunk_fn, .arg = arg, .buf = buf};
+    bool is_obj[JEMI_CBOR_MAX_DEPTH]; // kind of each open container
+    size_t depth = 0;
+    json_state_t state = JSON_VALUE;
+    const char *p = json;
+    const char *end = json + len;
+
+    while (true) {
+        while (p < end &&
+               (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p += 1;
+        }
+        if (p == end) {
+            break;
+        }
+        char ch = *p++;
+
+        switch (state) {
+        case JSON_ARRAY_START:
+        case JSON_OBJECT_START:
+        case JSON_NEXT: {
+            if (depth > 0 && ch == (is_obj[depth - 1] ? '}' : ']')) {
+                emit_char(&ctx, (char)CBOR_BREAK);
+                depth -= 1;
+                state = (depth == 0) ? JSON_DONE : JSON_NEXT;
+                continue;
+            } else if (state == JSON_NEXT) {
+                if (ch != ',') {
+                    return false;
+                }
+                state = is_obj[depth - 1] ? JSON_KEY : JSON_VALUE;
+                continue;
+            }
+        } break; // a key or value follows
+
+        case JSON_COLON: {
+            if (ch != ':') {
+                return false;
+            }
+            state = JSON_VALUE;
+            continue;
+        }
+
+        case JSON_DONE: {
+            return false; // trailing garbage
+        }
+
+        default: {
+            // a key or value follows
+        }
+        }
+
+        if (state == JSON_KEY || state == JSON_OBJECT_START) {
+            if (ch != '"' || !json_text(&ctx, &p, end)) {
+                return false;
+            }
+            state = JSON_COLON;
+        } else if (ch == '{' || ch == '[') {
+            if (depth == JEMI_CBOR_MAX_DEPTH) {
+                return false;
+            }
+            is_obj[depth++] = (ch == '{');
+            emit_char(&ctx, (char)((ch == '{' ? CBOR_MAP : CBOR_ARRAY) |
+                                   CBOR_INDEFINITE));
+            state = (ch == '{') ? JSON_OBJECT_START : JSON_ARRAY_START;
+        } else {
+            if (ch == '"') {
+                if (!json_text(&ctx, &p, end)) {
+                    return false;
+                }
+            } else if (ch == '-' || (ch >= '0' && ch <= '9')) {
+                p -= 1;
+                if (!json_number(&ctx, &p, end)) {
+                    return false;
+                }
+            } else {
+                p -= 1;
+                if (!json_literal(&ctx, &p, end)) {
+                    return false;
+                }
+            }
+            state = (depth == 0) ? JSON_DONE : JSON_NEXT;
+        }
+    }
+    emit_flush(&ctx);
+    return state == JSON_DONE;
+}
+
+jemi_node_t *jemi_parse_cbor(const uint8_t *buf, size_t len) {
+    jemi_node_t *root = NULL;
+    return cbor_decode(buf, len, &root) ? root : NULL;
+}
+
+size_t jemi_parse_cbor_requirements(const uint8_t *buf, size_t len) {
+    return cbor_decode(buf, len, NULL);
+}
+
+jemi_node_t *jemi_pointer_resolve(jemi_node_t *root, const char *pointer) {
     jemi_node_t *node = root;
-    while (node) {
-        if (is_obj && (count & 1)) {
-            writer_fn(':', arg);
-        } else if (count > 0) {
-            writer_fn(',', arg);
+
+    while (node && *pointer == '/') {
+        pointer += 1;
+        node = pointer_step(node, pointer);
+        pointer += strcspn(pointer, "/");
+    }
+    return (*pointer == '\0') ? node : NULL;
+}
+
+size_t jemi_pointer_resolve_many(jemi_node_t *root,
+                                 const char *const *pointers,
+                                 jemi_node_t **handles, size_t n_pointers) {
+    resolve_cursor_t cursors[RESOLVE_BATCH];
+    size_t resolved = 0;
+
+    for (size_t base = 0; base < n_pointers; base += RESOLVE_BATCH) {
+        size_t n = n_pointers - base;
+        if (n > RESOLVE_BATCH) {
+            n = RESOLVE_BATCH;
         }
-        switch (node->type) {
-        case JEMI_OBJECT: {
-            writer_fn('{', arg);
-            emit_aux(node->children, writer_fn, arg, true);
-            writer_fn('}', arg);
-        } break;
+        // every well-formed pointer starts out at root...
+        for (size_t i = 0; i < n; i++) {
+            const char *p = pointers[base + i];
+            handles[base + i] = (*p == '\0' || *p == '/') ? root : NULL;
+            cursors[i].token = NULL;
+            if (*p == '/') {
+                resolve_cursor_set(&cursors[i], p + 1);
+            }
+        }
+        // ... and then descends in lockstep with the others
+        if (root) {
+            resolve_many_aux(root, cursors, &handles[base], n);
+        }
+    }
+    for (size_t i = 0; i < n_pointers; i++) {
+        if (handles[i]) {
+            resolved += 1;
+        }
+    }
+    return resolved;
+}
 
-        case JEMI_ARRAY: {
-            writer_fn('[', arg);
-            emit_aux(node->children, writer_fn, arg, false);
-            writer_fn(']', arg);
-        } break;
+bool jemi_query_compile(jemi_query_t *query, const char *path) {
+    query->n_ops = 0;
+    if (*path++ != '$') {
+        return false;
+    }
+    while (*path) {
+        jemi_query_op_t *op = &query->ops[query->n_ops];
 
-        case JEMI_FLOAT: {
-            char buf[22];
-            int64_t i = node->number;
-            if ((double)i == node->number) {
-                // number can be represented as an int: suppress trailing zeros
-                snprintf(buf, sizeof(buf), "%lld", i);
+        if (path[0] == '.' && path[1] == '.') {
+            if (query->n_ops + 1 >= JEMI_QUERY_MAX_OPS) {
+                return false;
+            }
+            memset(op, 0, sizeof(*op));
+            op->opcode = QOP_DESCEND;
+            op = &query->ops[++query->n_ops];
+            path += (path[2] == '[') ? 2 : 1; // "..name" is "..[name]"
+        } else if (query->n_ops >= JEMI_QUERY_MAX_OPS) {
+            return false;
+        }
+        memset(op, 0, sizeof(*op));
+        if (*path == '.') {
+            path += 1;
+            if (*path == '*') {
+                op->opcode = QOP_WILDCARD;
+                path += 1;
+            } else if (!compile_name(op, &path, '\0')) {
+                return false;
+            }
+        } else if (*path == '[') {
+            path += 1;
+            if (*path == '*') {
+                op->opcode = QOP_WILDCARD;
+                path += 1;
+            } else if (*path == '\'' || *path == '"') {
+                char quote = *path++;
+                if (!compile_name(op, &path, quote)) {
+                    return false;
+                }
+            } else if (*path == '?') {
+                path += 1;
+                if (!compile_filter(op, &path)) {
+                    return false;
+                }
             } else {
-                snprintf(buf, sizeof(buf), "%lf", node->number);
+                char *end;
+                op->opcode = QOP_INDEX;
+                op->index = strtoll(path, &end, 10);
+                if (end == path) {
+                    return false;
+                }
+                path = end;
             }
-            emit_string(writer_fn, arg, buf);
-        } break;
+            if (*path++ != ']') {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        query->n_ops += 1;
+    }
+    return true;
+}
 
-        case JEMI_INTEGER: {
-            char buf[22]; // 20 digits, 1 sign, 1 null
-            snprintf(buf, sizeof(buf), "%lld", node->integer);
-            emit_string(writer_fn, arg, buf);
-        } break;
+int jemi_query_run(const jemi_query_t *query, jemi_node_t *root,
+                   jemi_match_fn_t match_fn, void *arg) {
+    query_ctx_t ctx = {.query = query, .match_fn = match_fn, .arg = arg};
 
-        case JEMI_STRING: {
-            writer_fn('"', arg);
-            emit_string(writer_fn, arg, node->string);
-            writer_fn('"', arg);
-        } break;
+    if (root) {
+        query_visit(&ctx, root, 0);
+    }
+    while (ctx.sp > 0) {
+        query_frame_t *frame = &ctx.stack[ctx.sp - 1];
+        jemi_node_t *key = frame->is_obj ? frame->cursor : NULL;
+        jemi_node_t *child = key ? key->sibling : frame->cursor;
+        const jemi_query_op_t *op = &query->ops[frame->pc];
 
-        case JEMI_TRUE: {
-            emit_string(writer_fn, arg, "true");
-        } break;
+        if (child == NULL) {
+            ctx.sp -= 1; // done with this frame
+            continue;
+        }
+        frame->cursor = child->sibling;
+        if (op->opcode == QOP_DESCEND) {
+            query_visit(&ctx, child, frame->pc);
+        } else if (op->opcode == QOP_WILDCARD || query_filter(op, child)) {
+            query_visit(&ctx, child, frame->pc + 1);
+        }
+    }
+    return ctx.overflow ? -1 : ctx.matches;
+}
 
-        case JEMI_FALSE: {
-            emit_string(writer_fn, arg, "false");
-        } break;
+bool jemi_schema_compile(jemi_schema_t *schema, jemi_node_t *root) {
+    schema->n_ops = 0;
+    return schema_compile_aux(schema, root, 0);
+}
 
-        case JEMI_NULL: {
-            emit_string(writer_fn, arg, "null");
-        } break;
+bool jemi_schema_validate(const jemi_schema_t *schema, jemi_node_t *node) {
+    schema_frame_t stack[JEMI_SCHEMA_MAX_DEPTH];
+    size_t sp = 0;
+    size_t pc = 0;
+
+    if (schema->n_ops == 0) {
+        return false; // not compiled
+    }
+    while ((node = deref(node)) != NULL) {
+        const jemi_schema_op_t *op = &schema->ops[pc];
+        jemi_node_t *child = NULL;
+
+        if (op->opcode == SOP_END) {
+            schema_frame_t *frame;
+            if (sp == 0) {
+                return true;
+            }
+            frame = &stack[sp - 1];
+            if (frame->cursor) {
+                // apply the same subschema to the next element
+                node = frame->cursor;
+                frame->cursor = node->sibling;
+                pc = frame->start;
+            } else {
+                node = frame->instance;
+                pc = frame->resume;
+                sp -= 1;
+            }
+            continue;
+        } else if (op->opcode == SOP_PROPERTY) {
+            if (node->type == JEMI_OBJECT) {
+                child = find_member(node, op->node->string,
+                                    string_length(op->node));
+            }
+        } else if (op->opcode == SOP_ITEMS) {
+            if (node->type == JEMI_ARRAY) {
+                child = node->children;
+            }
+        } else if (schema_check(op, node)) {
+            pc += 1;
+            continue;
+        } else {
+            return false;
+        }
+
+        if (child == NULL) {
+            pc += 1 + op->skip; // nothing for the subschema to validate
+        } else {
+            // compiling limits the nesting, so the stack can't overflow
+            stack[sp++] = (schema_frame_t){
+                .instance = node,
+                .cursor = (op->opcode == SOP_ITEMS) ? child->sibling : NULL,
+                .start = (uint16_t)(pc + 1),
+                .resume = (uint16_t)(pc + 1 + op->skip)};
+            node = child;
+            pc += 1;
         }
-        count += 1;
-        node = node->sibling;
     }
+    return false; // a reference to nothing
 }
 
-static jemi_node_t *copy_node(jemi_node_t *node) {
-    jemi_node_t *copy;
-    if (node == NULL) {
-        copy = NULL;
-    } else {
-        copy = jemi_alloc(node->type);
-        switch (node->type) {
-        case JEMI_ARRAY:
-        case JEMI_OBJECT: {
-            copy->children = jemi_copy(node->children);
-        } break;
-        case JEMI_STRING: {
-            copy->string = node->string;
-        } break;
-        case JEMI_FLOAT: {
-            copy->number = node->number;
+void jemi_iter_init(jemi_iter_t *it, jemi_node_t *root,
+                    jemi_iter_frame_t *stack, size_t max_depth) {
+    *it = (jemi_iter_t){.root = root,
+                        .stack = stack,
+                        .max_depth = max_depth,
+                        .event = JEMI_ITER_LEAF};
+}
+
+jemi_iter_event_t jemi_iter_next(jemi_iter_t *it) {
+    jemi_node_t *node = NULL;
+    jemi_node_t *key = NULL;
+
+    if (it->leave_next) {
+        // a skipped container: leave it right after entering it
+        it->leave_next = false;
+        return it->event = JEMI_ITER_LEAVE;
+    }
+    if (it->root) {
+        node = it->root;
+        it->root = NULL;
+    }
+    while (node == NULL) {
+        jemi_iter_frame_t *top;
+        if (it->depth == 0) {
+            it->node = it->key = NULL;
+            it->level = 0;
+            return it->event = JEMI_ITER_DONE;
         }
-        case JEMI_INTEGER: {
-            copy->integer = node->integer;
+        top = &it->stack[it->depth - 1];
+        node = top->cursor;
+        if (node && top->container->type == JEMI_OBJECT) {
+            key = node;
+            node = key->sibling; // NULL if the key has no value
         }
-        default: {
-            // no action needed
+        if (node == NULL) {
+            // no more children: leave the container
+            it->depth -= 1;
+            it->node = top->container;
+            it->key = top->key;
+            it->level = it->depth;
+            return it->event = JEMI_ITER_LEAVE;
         }
-        } // switch()
+        top->cursor = node->sibling;
     }
-    return copy;
+
+    it->node = deref(node) ? deref(node) : node;
+    it->key = key;
+    it->level = it->depth;
+    if (it->node->type != JEMI_ARRAY && it->node->type != JEMI_OBJECT) {
+        return it->event = JEMI_ITER_LEAF;
+    }
+    if (it->depth == it->max_depth) {
+        it->overflow = true;
+        it->leave_next = true;
+    } else {
+        it->stack[it->depth++] = (jemi_iter_frame_t){
+            .container = it->node, .key = key, .cursor = it->node->children};
+    }
+    return it->event = JEMI_ITER_ENTER;
+}
+
+void jemi_iter_skip(jemi_iter_t *it) {
+    if (it->event == JEMI_ITER_ENTER && !it->leave_next) {
+        it->depth -= 1; // pop the frame pushed on entering
+        it->leave_next = true;
+    }
+}
+
+jemi_node_t *jemi_persist_set(jemi_node_t *root, jemi_node_t *target,
+                              jemi_node_t *value) {
+    return persist(root, target, PERSIST_SET, value);
+}
+
+jemi_node_t *jemi_persist_append(jemi_node_t *root, jemi_node_t *container,
+                                 jemi_node_t *items) {
+    jemi_node_t *target = deref(container);
+
+    if (target == NULL ||
+        (target->type != JEMI_ARRAY && target->type != JEMI_OBJECT)) {
+        return NULL; // only containers have children to append to
+    }
+    return persist(root, container, PERSIST_APPEND, items);
+}
+
+jemi_node_t *jemi_persist_remove(jemi_node_t *root, jemi_node_t *target) {
+    return persist(root, target, PERSIST_REMOVE, NULL);
+}
+
+void jemi_emit(jemi_node_t *root, jemi_writer_t writer_fn, void *arg) {
+    emit_ctx_t ctx = {.writer_fn = writer_fn, .arg = arg};
+    emit_aux(&ctx, root, false);
+    writer_fn('\0', arg);
 }
 
-static void emit_string(jemi_writer_t writer_fn, void *arg, const char *buf) {
-    while (*buf) {
-        writer_fn(*buf++, arg);
+#ifdef JEMI_GENERATIONS
+uint32_t jemi_generation(void) { return s_jemi_generation++; }
+
+void jemi_emit_since(jemi_node_t *root, uint32_t generation,
+                     jemi_writer_t writer_fn, void *arg) {
+    emit_ctx_t ctx = {.writer_fn = writer_fn, .arg = arg};
+    if (root && root->type == JEMI_OBJECT) {
+        emit_changed(&ctx, root, generation);
+    } else if (root && root->generation > generation) {
+        emit_node(&ctx, root);
+    }
+    writer_fn('\0', arg);
+}
+#endif
+
+void jemi_emit_slots(jemi_node_t *root, jemi_slot_t *slots, size_t n_slots,
+                     jemi_writer_t writer_fn, void *arg) {
+    emit_ctx_t ctx = {.writer_fn = writer_fn,
+                      .arg = arg,
+                      .slots = slots,
+                      .n_slots = n_slots};
+    emit_aux(&ctx, root, false);
+    writer_fn('\0', arg);
+}
+
+void jemi_emit_chunked(jemi_node_t *root, jemi_chunk_writer_t chunk_fn,
+                       void *arg) {
+    char buf[JEMI_CHUNK_SIZE];
+    emit_ctx_t ctx = {.chunk_fn = chunk_fn, .arg = arg, .buf = buf};
+    emit_aux(&ctx, root, false);
+    emit_flush(&ctx);
+}
+
+void jemi_emit_pretty(jemi_node_t *root, const jemi_pretty_t *style,
+                      jemi_writer_t writer_fn, void *arg) {
+    emit_ctx_t ctx = {.writer_fn = writer_fn,
+                      .arg = arg,
+                      .pretty = style ? style : &s_pretty_default};
+    emit_aux(&ctx, root, false);
+    writer_fn('\0', arg);
+}
+
+void jemi_emit_pretty_chunked(jemi_node_t *root, const jemi_pretty_t *style,
+                              jemi_chunk_writer_t chunk_fn, void *arg) {
+    char buf[JEMI_CHUNK_SIZE];
+    emit_ctx_t ctx = {.chunk_fn = chunk_fn,
+                      .arg = arg,
+                      .buf = buf,
+                      .pretty = style ? style : &s_pretty_default};
+    emit_aux(&ctx, root, false);
+    emit_flush(&ctx);
+}
+
+void jemi_spill_init(jemi_chunk_writer_t write_fn,
+                     jemi_spill_reader_t read_fn, void *arg) {
+    s_jemi_spill = (spill_store_t){
+        .write_fn = write_fn, .read_fn = read_fn, .arg = arg, .size = 0};
+}
+
+bool jemi_spill(jemi_node_t *node) {
+    char buf[JEMI_CHUNK_SIZE];
+    emit_ctx_t ctx = {
+        .chunk_fn = s_jemi_spill.write_fn, .arg = s_jemi_spill.arg, .buf = buf};
+
+    if (node == NULL || ctx.chunk_fn == NULL || s_jemi_spill.read_fn == NULL ||
+        (node->type != JEMI_ARRAY && node->type != JEMI_OBJECT)) {
+        return false;
+    }
+    emit_node(&ctx, node);
+    emit_flush(&ctx);
+    s_jemi_spill.size += ctx.count;
+    if (s_jemi_spill.size > UINT32_MAX) {
+        return false; // offset won't fit: bytes are written but go unused
+    }
+    free_list(node->children);
+    node->type = JEMI_SPILLED;
+    node->spill.offset = s_jemi_spill.size - ctx.count;
+    node->spill.length = ctx.count;
+    return true;
+}
+
+void jemi_footprint(jemi_node_t *root, jemi_footprint_t *footprint) {
+    *footprint = (jemi_footprint_t){0};
+    footprint_aux(root, 0, footprint);
+}
+
+size_t jemi_pool_dump(jemi_node_t *const *roots, size_t n_roots,
+                      jemi_pool_state_t *states) {
+    size_t leaked = 0;
+
+    for (size_t i = 0; i < s_jemi_pool_size; i++) {
+        states[i] = JEMI_POOL_LEAKED;
+    }
+    for (jemi_node_t *node = s_jemi_freelist; node; node = node->sibling) {
+        states[node - s_jemi_pool] = JEMI_POOL_FREE;
+    }
+    for (size_t i = 0; i < n_roots; i++) {
+        mark_live(roots[i], states);
+    }
+    for (size_t i = 0; i < s_jemi_pool_size; i++) {
+        leaked += states[i] == JEMI_POOL_LEAKED;
+    }
+    return leaked;
+}
+
+bool jemi_slot_set_int(const jemi_slot_t *slot, char *buf, int64_t value) {
+    char digits[21]; // 20 digits, 1 sign
+    size_t len = format_int64(digits, value);
+    char *dst = &buf[slot->offset];
+    const char *src = digits;
+
+    if (len > slot->width) {
+        return false;
+    }
+    if (slot->pad == '0' && value < 0) {
+        *dst++ = *src++; // sign precedes the zeros
+        len -= 1;
+    }
+    memset(dst, slot->pad, slot->width - (dst - &buf[slot->offset]) - len);
+    memcpy(&buf[slot->offset + slot->width - len], src, len);
+    return true;
+}
+
+size_t jemi_available(void) {
+    size_t count = 0;
+
+    jemi_node_t *node = s_jemi_freelist;
+    while (node) {
+        count += 1;
+        node = node->sibling;
+    }
+    return count;
+}
+
+// *****************************************************************************
+// Private (static) code
+
+static jemi_node_t *jemi_alloc(jemi_type_t type) {
+    return pop_node(&s_jemi_freelist, type);
+}
+
+static jemi_node_t *pop_node(jemi_node_t **freelist, jemi_type_t type) {
+    jemi_node_t *node = *freelist;
+    if (node) {
+        *freelist = node->sibling;
+        node->sibling = NULL;
+        init_node(node, type, NULL);
+    }
+    return node;
+}
+
+static jemi_node_t *jemi_alloc_n(size_t n) {
+    jemi_node_t *first = s_jemi_freelist;
+    jemi_node_t *last = first;
+
+    if (n == 0) {
+        return NULL;
+    }
+    for (size_t i = 1; last && i < n; i++) {
+        last = last->sibling;
+    }
+    if (last == NULL) {
+        return NULL; // not enough nodes
+    }
+    // the nodes are already linked: just detach them from the freelist
+    s_jemi_freelist = last->sibling;
+    last->sibling = NULL;
+    return first;
+}
+
+static jemi_node_t *array_from(jemi_type_t type, const void *values,
+                               size_t n) {
+    jemi_node_t *array = jemi_alloc_n(n + 1);
+    jemi_node_t *node;
+
+    if (array == NULL) {
+        return NULL;
+    }
+    node = array->sibling;
+    array->sibling = NULL;
+    init_node(array, JEMI_ARRAY, NULL);
+    array->children = (n > 0) ? node : NULL;
+    array->length = n;
+    for (size_t i = 0; i < n; i++, node = node->sibling) {
+        init_node(node, type, array);
+        set_value(node, type, values, i);
+    }
+    return array;
+}
+
+static jemi_node_t *object_from(const char *const *keys,
+                                jemi_node_t *const *nodes, jemi_type_t type,
+                                const void *values, size_t n) {
+    jemi_node_t *object;
+    jemi_node_t *key;
+
+    if (nodes == NULL && type != JEMI_INTEGER && type != JEMI_FLOAT &&
+        type != JEMI_STRING && type != JEMI_TRUE) {
+        return NULL; // not a column type
+    }
+    for (size_t i = 0; nodes && i < n; i++) {
+        if (nodes[i] == NULL) {
+            return NULL; // e.g. a value that didn't fit in the pool
+        }
+    }
+    // one node per key, plus one per value unless they're already given
+    if ((object = jemi_alloc_n(nodes ? n + 1 : 2 * n + 1)) == NULL) {
+        return NULL;
+    }
+    key = object->sibling;
+    object->sibling = NULL;
+    init_node(object, JEMI_OBJECT, NULL);
+    object->children = (n > 0) ? key : NULL;
+    object->length = 2 * n;
+    for (size_t i = 0; i < n; i++) {
+        jemi_node_t *value;
+        init_node(key, JEMI_STRING, object);
+        key->string = keys[i];
+        if (nodes) {
+            // splice the given value between this key and the next
+            value = nodes[i];
+            value->sibling = key->sibling;
+            key->sibling = value;
+#ifdef JEMI_GENERATIONS
+            value->parent = object;
+#endif
+        } else {
+            value = key->sibling;
+            init_node(value, type, object);
+            set_value(value, type, values, i);
+        }
+        key = value->sibling;
+    }
+    return object;
+}
+
+static void init_node(jemi_node_t *node, jemi_type_t type,
+                      jemi_node_t *parent) {
+    node->type = type;
+    node->length = 0;
+#ifdef JEMI_GENERATIONS
+    node->parent = parent;
+    node->generation = s_jemi_generation;
+#else
+    (void)parent;
+#endif
+}
+
+static void set_value(jemi_node_t *node, jemi_type_t type, const void *values,
+                      size_t i) {
+    if (type == JEMI_INTEGER) {
+        node->integer = ((const int64_t *)values)[i];
+    } else if (type == JEMI_FLOAT) {
+        node->number = ((const double *)values)[i];
+    } else if (type == JEMI_STRING) {
+        node->string = ((const char *const *)values)[i];
+    } else if (type == JEMI_TRUE) {
+        node->type = ((const bool *)values)[i] ? JEMI_TRUE : JEMI_FALSE;
+    }
+}
+
+static void adopt(jemi_node_t *parent, jemi_node_t *list) {
+    for (; list; list = list->sibling) {
+        parent->length += 1;
+#ifdef JEMI_GENERATIONS
+        list->parent = parent;
+#endif
+    }
+}
+
+static void touch(jemi_node_t *node) {
+#ifdef JEMI_GENERATIONS
+    // ancestors already stamped in this generation need no further work
+    while (node && node->generation != s_jemi_generation) {
+        node->generation = s_jemi_generation;
+        node = node->parent;
+    }
+#else
+    (void)node;
+#endif
+}
+
+static void stamp_list(jemi_node_t *list) {
+#ifdef JEMI_GENERATIONS
+    for (; list; list = list->sibling) {
+        list->generation = s_jemi_generation;
+    }
+#else
+    (void)list;
+#endif
+}
+
+static void free_list(jemi_node_t *list) {
+    while (list) {
+        jemi_node_t *next = list->sibling;
+        jemi_free(list);
+        list = next;
+    }
+}
+
+static void footprint_aux(jemi_node_t *node, size_t depth,
+                          jemi_footprint_t *footprint) {
+    if (node == NULL) {
+        return;
+    }
+    footprint->nodes += 1;
+    footprint->by_type[node->type] += 1;
+    if (depth > footprint->max_depth) {
+        footprint->max_depth = depth;
+    }
+    switch (node->type) {
+    case JEMI_ARRAY:
+    case JEMI_OBJECT:
+        if (jemi_length(node) > footprint->max_fanout) {
+            footprint->max_fanout = jemi_length(node);
+        }
+        for (jemi_node_t *child = node->children; child;
+             child = child->sibling) {
+            footprint_aux(child, depth + 1, footprint);
+        }
+        break;
+    case JEMI_CONCAT:
+        // parts are part of the string, not nested values
+        for (jemi_node_t *part = node->children; part; part = part->sibling) {
+            footprint_aux(part, depth, footprint);
+        }
+        break;
+    case JEMI_STRING:
+        footprint->string_bytes += string_length(node);
+        break;
+    case JEMI_SPILLED:
+        footprint->spilled_bytes += node->spill.length;
+        break;
+    default:
+        break;
+    }
+}
+
+static void mark_live(jemi_node_t *node, jemi_pool_state_t *states) {
+    while (node && node >= s_jemi_pool &&
+           node < s_jemi_pool + s_jemi_pool_size &&
+           states[node - s_jemi_pool] != JEMI_POOL_LIVE) {
+        states[node - s_jemi_pool] = JEMI_POOL_LIVE;
+        if (node->type == JEMI_ARRAY || node->type == JEMI_OBJECT ||
+            node->type == JEMI_CONCAT) {
+            for (jemi_node_t *child = node->children; child;
+                 child = child->sibling) {
+                mark_live(child, states);
+            }
+            return;
+        } else if (node->type != JEMI_REF) {
+            return;
+        }
+        node = node->ref; // a referenced structure is in use too
+    }
+}
+
+static void emit_aux(emit_ctx_t *ctx, jemi_node_t *root, bool is_obj) {
+    int count = 0;
+    jemi_node_t *node = root;
+    while (node) {
+        if (!is_obj && node->type == JEMI_INTEGER && ctx->n_slots == 0 &&
+            ctx->pretty == NULL) {
+            // Format a run of integers into one buffer and emit it at once
+            char buf[JEMI_CHUNK_SIZE + 22];
+            size_t len = 0;
+            do {
+                if (count++ > 0) {
+                    buf[len++] = ',';
+                }
+                len += node->length
+                           ? format_uint64(&buf[len], (uint64_t)node->integer)
+                           : format_int64(&buf[len], node->integer);
+                node = node->sibling;
+            } while (node && node->type == JEMI_INTEGER &&
+                     len <= JEMI_CHUNK_SIZE);
+            emit_chars(ctx, buf, len);
+            continue;
+        }
+        if (is_obj && (count & 1)) {
+            emit_char(ctx, ':');
+            if (ctx->pretty) {
+                emit_char(ctx, ' ');
+            }
+        } else {
+            if (count > 0) {
+                emit_char(ctx, ',');
+            }
+            if (ctx->pretty && (count > 0 || ctx->depth > 0)) {
+                emit_indent(ctx);
+            }
+        }
+        emit_node(ctx, node);
+        count += 1;
+        node = node->sibling;
+    }
+}
+
+static void emit_indent(emit_ctx_t *ctx) {
+    const char *run = (ctx->pretty->indent_char == '\t') ? s_indent_tabs
+                                                          : s_indent_spaces;
+    size_t n = ctx->depth * ctx->pretty->indent;
+
+    emit_string(ctx, ctx->pretty->newline);
+    while (n > 0) {
+        size_t len = (n < INDENT_RUN) ? n : INDENT_RUN;
+        emit_chars(ctx, run, len);
+        n -= len;
+    }
+}
+
+static void emit_node(emit_ctx_t *ctx, jemi_node_t *node) {
+    if (node == NULL) {
+        emit_string(ctx, "null"); // nothing to write
+        return;
+    }
+    switch (node->type) {
+    case JEMI_OBJECT:
+    case JEMI_ARRAY: {
+        bool is_obj = node->type == JEMI_OBJECT;
+        emit_char(ctx, is_obj ? '{' : '[');
+        ctx->depth += 1;
+        emit_aux(ctx, node->children, is_obj);
+        ctx->depth -= 1;
+        if (ctx->pretty && node->children) {
+            emit_indent(ctx);
+        }
+        emit_char(ctx, is_obj ? '}' : ']');
+    } break;
+
+    case JEMI_FLOAT:
+    case JEMI_INTEGER: {
+        for (size_t i = 0; i < ctx->n_slots; i++) {
+            if (ctx->slots[i].node == node) {
+                emit_slot(ctx, &ctx->slots[i]);
+                return;
+            }
+        }
+        emit_number(ctx, node);
+    } break;
+
+    case JEMI_STRING: {
+        emit_char(ctx, '"');
+        if (node->length & JEMI_STRING_RAW) {
+            emit_escaped(ctx, node->string, string_length(node));
+        } else {
+            emit_chars(ctx, node->string, string_length(node));
+        }
+        emit_char(ctx, '"');
+    } break;
+
+    case JEMI_TRUE: {
+        emit_string(ctx, "true");
+    } break;
+
+    case JEMI_FALSE: {
+        emit_string(ctx, "false");
+    } break;
+
+    case JEMI_NULL: {
+        emit_string(ctx, "null");
+    } break;
+
+    case JEMI_REF: {
+        emit_node(ctx, node->ref); // a ref to nothing is written as null
+    } break;
+
+    case JEMI_CONCAT: {
+        emit_char(ctx, '"');
+        emit_concat(ctx, node->children);
+        emit_char(ctx, '"');
+    } break;
+    case JEMI_SPILLED: {
+        emit_spilled(ctx, node);
+    } break;
+    }
+}
+
+#ifdef JEMI_GENERATIONS
+static void emit_changed(emit_ctx_t *ctx, jemi_node_t *object,
+                         uint32_t generation) {
+    int count = 0;
+    jemi_node_t *key = object->children;
+
+    emit_char(ctx, '{');
+    while (key && key->sibling) {
+        jemi_node_t *value = key->sibling;
+        bool new_key = key->generation > generation;
+        if (new_key || value->generation > generation) {
+            if (count++ > 0) {
+                emit_char(ctx, ',');
+            }
+            emit_node(ctx, key);
+            emit_char(ctx, ':');
+            if (value->type == JEMI_OBJECT && !new_key) {
+                emit_changed(ctx, value, generation);
+            } else {
+                emit_node(ctx, value);
+            }
+        }
+        key = value->sibling;
+    }
+    emit_char(ctx, '}');
+}
+#endif
+
+static void emit_number(emit_ctx_t *ctx, jemi_node_t *node) {
+    char buf[NUMBER_SIZE];
+    emit_chars(ctx, buf, format_number(node, buf, sizeof(buf)));
+}
+
+static void emit_slot(emit_ctx_t *ctx, jemi_slot_t *slot) {
+    char buf[NUMBER_SIZE];
+    size_t len = format_number(slot->node, buf, sizeof(buf));
+    const char *src = buf;
+
+    if (len > slot->width) {
+        // widen the slot to fit, or (if even the widest slot is too narrow)
+        // write the number in full into a slot that can't be rewritten
+        slot->width = (len <= UINT8_MAX) ? len : 0;
+    }
+    slot->offset = ctx->count;
+    if (slot->pad == '0' && *src == '-') {
+        emit_char(ctx, *src++); // sign precedes the zeros
+        len -= 1;
+    }
+    while (ctx->count + len < slot->offset + slot->width) {
+        emit_char(ctx, slot->pad);
+    }
+    emit_string(ctx, src);
+}
+
+static size_t format_number(jemi_node_t *node, char *buf, size_t size) {
+    size_t len;
+
+    if (node->type == JEMI_FLOAT) {
+        double number = node->number;
+        // the int64_t cast is only defined in range (2^63 itself is out, and
+        // so is NaN)
+        if (!(number >= -9223372036854775808.0 &&
+              number < 9223372036854775808.0) ||
+            (double)(int64_t)number != number) {
+            int n = snprintf(buf, size, "%lf", number);
+            return ((size_t)n < size) ? (size_t)n : size - 1; // truncated?
+        }
+        // number can be represented as an int: suppress trailing zeros
+        len = format_int64(buf, (int64_t)number);
+    } else if (node->length) {
+        len = format_uint64(buf, (uint64_t)node->integer);
+    } else {
+        len = format_int64(buf, node->integer);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static size_t format_int64(char *buf, int64_t value) {
+    if (value < 0) {
+        *buf = '-';
+        return 1 + format_uint64(&buf[1], -(uint64_t)value);
+    }
+    return format_uint64(buf, (uint64_t)value);
+}
+
+static size_t format_uint64(char *buf, uint64_t value) {
+    char digits[20];
+    char *p = &digits[sizeof(digits)];
+    uint64_t u = value;
+    size_t len;
+
+    // generate digits from right to left, two at a time
+    while (u >= 100) {
+        p -= 2;
+        memcpy(p, &s_digit_pairs[(u % 100) * 2], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, &s_digit_pairs[u * 2], 2);
+    } else {
+        *--p = '0' + u;
+    }
+    len = &digits[sizeof(digits)] - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+static double integer_value(const jemi_node_t *node) {
+    return node->length ? (double)(uint64_t)node->integer
+                        : (double)node->integer;
+}
+
+static jemi_node_t *copy_list(jemi_node_t **freelist, jemi_node_t *root) {
+    jemi_node_t *r2 = NULL;
+    jemi_node_t *prev = NULL;
+    jemi_node_t *node;
+
+    while ((node = copy_node(freelist, root)) != NULL) {
+        if (r2 == NULL) {
+            // first time through the loop: save pointer to first element
+            r2 = node;
+        }
+        if (prev != NULL) {
+            prev->sibling = node;
+        }
+        prev = node;
+        root = root->sibling;
+    }
+    return r2;
+}
+
+static jemi_node_t *copy_node(jemi_node_t **freelist, jemi_node_t *node) {
+    jemi_node_t *copy;
+    if (node == NULL) {
+        copy = NULL;
+    } else if ((copy = pop_node(freelist, node->type)) != NULL) {
+        switch (node->type) {
+        case JEMI_ARRAY:
+        case JEMI_OBJECT:
+        case JEMI_CONCAT: {
+            copy->children = copy_list(freelist, node->children);
+            adopt(copy, copy->children);
+        } break;
+        case JEMI_STRING: {
+            copy->string = node->string;
+            copy->length = node->length;
+        } break;
+        case JEMI_FLOAT: {
+            copy->number = node->number;
+        } break;
+        case JEMI_INTEGER: {
+            copy->integer = node->integer;
+            copy->length = node->length;
+        } break;
+        case JEMI_REF: {
+            copy->ref = node->ref; // the referenced node is shared, not copied
+        } break;
+        case JEMI_SPILLED: {
+            copy->spill = node->spill; // the spilled bytes are shared
+        } break;
+        default: {
+            // no action needed
+        }
+        } // switch()
+    }
+    return copy;
+}
+
+static size_t list_size(jemi_node_t *list) {
+    size_t n = 0;
+
+    for (; list; list = list->sibling) {
+        n += 1;
+        if (list->type == JEMI_ARRAY || list->type == JEMI_OBJECT ||
+            list->type == JEMI_CONCAT) {
+            n += list_size(list->children);
+        }
+    }
+    return n;
+}
+
+static jemi_node_t *merge_patch(jemi_node_t *target, jemi_node_t *patch) {
+    jemi_node_t *referent = deref(target);
+
+    if (referent) {
+        target = referent; // a ref is patched where it points
+    }
+    if (patch->type != JEMI_OBJECT) {
+        // target is replaced by patch
+        if (target == NULL) {
+            return copy_node(&s_jemi_freelist, patch);
+        }
+        if (target->type == JEMI_ARRAY || target->type == JEMI_OBJECT ||
+            target->type == JEMI_CONCAT) {
+            free_list(target->children);
+        }
+        target->type = patch->type;
+        target->length = 0;
+        if (patch->type == JEMI_ARRAY || patch->type == JEMI_CONCAT) {
+            // parts are copied too, so target and patch can be freed apart
+            target->children = jemi_copy(patch->children);
+            adopt(target, target->children);
+        } else {
+            target->integer = patch->integer; // copies the union verbatim
+            target->length = patch->length;
+        }
+        touch(target);
+        return target;
+    }
+
+    if (target == NULL) {
+        if ((target = jemi_alloc(JEMI_OBJECT)) == NULL) {
+            return NULL;
+        }
+        target->children = NULL;
+    } else if (target->type != JEMI_OBJECT) {
+        if (target->type == JEMI_ARRAY || target->type == JEMI_CONCAT) {
+            free_list(target->children);
+        }
+        target->type = JEMI_OBJECT;
+        target->children = NULL;
+        target->length = 0;
+        touch(target);
+    }
+
+    for (jemi_node_t *key = patch->children; key && key->sibling;
+         key = key->sibling->sibling) {
+        jemi_node_t *value = deref(key->sibling);
+        jemi_node_t *prev = NULL; // last node before the matching key
+        jemi_node_t *match = target->children;
+
+        // find the member of target with the same key
+        while (match && match->sibling) {
+            if (match->type == JEMI_STRING && key->type == JEMI_STRING &&
+                string_equals(match, key->string, string_length(key))) {
+                break;
+            }
+            prev = match->sibling;
+            match = prev->sibling;
+        }
+        if (match && match->sibling == NULL) {
+            match = NULL; // dangling key without a value
+        }
+
+        if (value == NULL || value->type == JEMI_NULL) {
+            if (match) {
+                // unlink the key/value pair and return it to the pool
+                jemi_node_t *next = match->sibling->sibling;
+                if (prev) {
+                    prev->sibling = next;
+                } else {
+                    target->children = next;
+                }
+                target->length -= 2;
+                touch(target);
+                jemi_free(match->sibling);
+                jemi_free(match);
+            }
+        } else if (match) {
+            merge_patch(match->sibling, value);
+        } else {
+            jemi_node_t *k2 = jemi_string(key->string);
+            if (k2) {
+                k2->length = key->length;
+            }
+            jemi_node_t *v2 = k2 ? merge_patch(NULL, value) : NULL;
+            if (v2 == NULL) {
+                jemi_free(k2);
+                break; // out of nodes
+            }
+            jemi_object_append(target, jemi_list(k2, v2, NULL));
+        }
+    }
+    return target;
+}
+
+static size_t patch_cost(jemi_node_t *target, jemi_node_t *patch) {
+    jemi_node_t *referent = deref(target);
+    size_t cost = 0;
+
+    if (referent) {
+        target = referent;
+    }
+
+    if (patch->type != JEMI_OBJECT) {
+        // a copy of patch, or of its parts (target's own parts are freed first,
+        // but aren't counted: this errs on the safe side)
+        if (target == NULL) {
+            cost = 1;
+        }
+        if (patch->type == JEMI_ARRAY || patch->type == JEMI_CONCAT) {
+            cost += list_size(patch->children);
+        }
+        return cost;
+    }
+    if (target == NULL) {
+        cost = 1; // a new object
+    } else if (target->type != JEMI_OBJECT) {
+        target = NULL; // becomes an empty object: nothing matches
+    }
+    for (jemi_node_t *key = patch->children; key && key->sibling;
+         key = key->sibling->sibling) {
+        jemi_node_t *value = deref(key->sibling);
+        jemi_node_t *match = NULL;
+
+        if (value == NULL || value->type == JEMI_NULL) {
+            continue; // removing a member allocates nothing
+        }
+        if (target && key->type == JEMI_STRING) {
+            match = find_member(target, key->string, string_length(key));
+        }
+        cost += match ? patch_cost(match, value) : 1 + patch_cost(NULL, value);
+    }
+    return cost;
+}
+
+static bool token_matches_key(const char *token, const char *key,
+                              size_t len) {
+    while (*token != '\0' && *token != '/') {
+        char ch = *token++;
+        if (ch == '~') {
+            if (*token != '0' && *token != '1') {
+                return false; // malformed escape
+            }
+            ch = (*token++ == '0') ? '~' : '/';
+        }
+        if (len-- == 0 || ch != *key++) {
+            return false;
+        }
+    }
+    return len == 0;
+}
+
+static bool token_matches_index(const char *token, size_t index) {
+    size_t value = 0;
+    const char *p = token;
+
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+    }
+    if (p == token || (*p != '\0' && *p != '/')) {
+        return false; // empty or not a number
+    } else if (*token == '0' && p - token > 1) {
+        return false; // leading zeros are not allowed
+    }
+    return value == index;
+}
+
+static jemi_node_t *pointer_step(jemi_node_t *container, const char *token) {
+    jemi_node_t *node;
+
+    if ((container = deref(container)) == NULL) {
+        return NULL; // a reference to nothing has no children
+    } else if (container->type == JEMI_OBJECT) {
+        node = container->children;
+        while (node && node->sibling) {
+            if (node->type == JEMI_STRING &&
+                token_matches_key(token, node->string, string_length(node))) {
+                return node->sibling;
+            }
+            node = node->sibling->sibling;
+        }
+    } else if (container->type == JEMI_ARRAY) {
+        node = container->children;
+        for (size_t i = 0; node; i++, node = node->sibling) {
+            if (token_matches_index(token, i)) {
+                return node;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void resolve_cursor_set(resolve_cursor_t *cursor, const char *token) {
+    cursor->token = token;
+    cursor->len = strcspn(token, "/");
+    cursor->escaped = memchr(token, '~', cursor->len) != NULL;
+}
+
+static void resolve_many_aux(jemi_node_t *container, resolve_cursor_t *cursors,
+                             jemi_node_t **handles, size_t n_pointers) {
+    jemi_node_t *target = deref(container);
+    bool is_obj = target && target->type == JEMI_OBJECT;
+    jemi_node_t *node = NULL;
+    uint8_t live[RESOLVE_BATCH]; // pointers still looking for a child here
+    size_t n_live = 0;
+
+    for (size_t i = 0; i < n_pointers; i++) {
+        if (handles[i] == container && cursors[i].token) {
+            live[n_live++] = i;
+        }
+    }
+    if (is_obj || (target && target->type == JEMI_ARRAY)) {
+        node = target->children;
+    }
+
+    for (size_t index = 0; node && n_live > 0; index++) {
+        jemi_node_t *key = is_obj ? node : NULL;
+        jemi_node_t *child = is_obj ? node->sibling : node;
+        size_t key_len = 0;
+        bool descend = false;
+
+        if (child == NULL) {
+            break; // key without a value
+        } else if (key && key->type != JEMI_STRING) {
+            node = child->sibling;
+            continue;
+        } else if (key) {
+            key_len = string_length(key);
+        }
+        for (size_t j = 0; j < n_live;) {
+            resolve_cursor_t *cursor = &cursors[live[j]];
+            bool match;
+            if (key == NULL) {
+                match = token_matches_index(cursor->token, index);
+            } else if (cursor->escaped) {
+                match = token_matches_key(cursor->token, key->string, key_len);
+            } else {
+                match = cursor->len == key_len &&
+                        memcmp(cursor->token, key->string, key_len) == 0;
+            }
+            if (!match) {
+                j += 1;
+                continue;
+            }
+            // advance the pointer to child and retire it from this level
+            handles[live[j]] = child;
+            if (cursor->token[cursor->len] == '/') {
+                resolve_cursor_set(cursor, &cursor->token[cursor->len + 1]);
+                descend = true;
+            } else {
+                cursor->token = NULL;
+            }
+            live[j] = live[--n_live];
+        }
+        if (descend) {
+            resolve_many_aux(child, cursors, handles, n_pointers);
+        }
+        node = child->sibling;
+    }
+    // pointers that still refer to container but have more tokens: no match
+    while (n_live > 0) {
+        handles[live[--n_live]] = NULL;
+    }
+}
+
+static uint32_t hash_node(uint32_t hash, jemi_node_t *node) {
+    uint8_t type;
+
+    if ((node = deref(node)) == NULL) {
+        return hash;
+    }
+    type = node->type;
+    hash = hash_bytes(hash, &type, sizeof(type));
+    switch (node->type) {
+    case JEMI_ARRAY:
+    case JEMI_OBJECT:
+    case JEMI_CONCAT: {
+        for (jemi_node_t *child = node->children; child; child = child->sibling) {
+            hash = hash_node(hash, child);
+        }
+        hash = hash_bytes(hash, &type, sizeof(type)); // mark end of children
+    } break;
+    case JEMI_FLOAT: {
+        // -0.0 == 0.0, so they must hash alike
+        double number = (node->number == 0.0) ? 0.0 : node->number;
+        hash = hash_bytes(hash, &number, sizeof(number));
+    } break;
+    case JEMI_INTEGER: {
+        hash = hash_bytes(hash, &node->integer, sizeof(node->integer));
+    } break;
+    case JEMI_STRING: {
+        hash = hash_bytes(hash, node->string, string_length(node));
+        hash = hash_bytes(hash, "", 1); // mark end of string
+    } break;
+    case JEMI_SPILLED: {
+        hash = hash_bytes(hash, &node->spill, sizeof(node->spill));
+    } break;
+    default: {
+        // the type says it all
+    }
+    }
+    return hash;
+}
+
+static uint32_t hash_bytes(uint32_t hash, const void *bytes, size_t n) {
+    const uint8_t *p = bytes;
+    while (n-- > 0) {
+        hash = (hash ^ *p++) * 16777619u; // FNV-1a prime
+    }
+    return hash;
+}
+
+static jemi_node_t *deref(jemi_node_t *node) {
+    while (node && node->type == JEMI_REF) {
+        node = node->ref;
+    }
+    return node;
+}
+
+static size_t string_length(const jemi_node_t *node) {
+    size_t len = node->length & ~JEMI_STRING_RAW;
+    return len ? len : strlen(node->string);
+}
+
+static bool string_equals(const jemi_node_t *node, const char *text,
+                          size_t len) {
+    return string_length(node) == len && memcmp(node->string, text, len) == 0;
+}
+
+static jemi_node_t *find_member(jemi_node_t *object, const char *key,
+                                size_t len) {
+    jemi_node_t *node = object->children;
+
+    while (node && node->sibling) {
+        if (node->type == JEMI_STRING && string_equals(node, key, len)) {
+            return node->sibling;
+        }
+        node = node->sibling->sibling;
+    }
+    return NULL;
+}
+
+static bool compile_name(jemi_query_op_t *op, const char **path, char quote) {
+    const char *p = *path;
+
+    if (quote) {
+        while (*p && *p != quote) {
+            p++;
+        }
+        if (*p != quote) {
+            return false; // unterminated string
+        }
+    } else {
+        while (*p && *p != '.' && *p != '[') {
+            p++;
+        }
+    }
+    op->opcode = QOP_MEMBER;
+    op->key = *path;
+    op->key_len = p - *path;
+    *path = quote ? p + 1 : p;
+    return quote || op->key_len > 0;
+}
+
+static bool compile_filter(jemi_query_op_t *op, const char **path) {
+    const char *p = *path;
+
+    if (p[0] != '(' || p[1] != '@') {
+        return false;
+    }
+    p += 2;
+    op->opcode = QOP_FILTER;
+    if (*p == '.') {
+        op->key = ++p;
+        while (*p && strchr(" =!<>)", *p) == NULL) {
+            p++;
+        }
+        op->key_len = p - op->key;
+    }
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p == ')') {
+        op->compare = QCMP_EXISTS;
+    } else {
+        static const char *ops[] = {"==", "!=", "<=", ">=", "<", ">"};
+        static const uint8_t cmps[] = {QCMP_EQ, QCMP_NE, QCMP_LE,
+                                       QCMP_GE, QCMP_LT, QCMP_GT};
+        size_t i;
+        for (i = 0; i < sizeof(cmps); i++) {
+            if (strncmp(p, ops[i], strlen(ops[i])) == 0) {
+                op->compare = cmps[i];
+                p += strlen(ops[i]);
+                break;
+            }
+        }
+        if (i == sizeof(cmps)) {
+            return false; // unknown operator
+        }
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\'' || *p == '"') {
+            char quote = *p++;
+            op->literal = JEMI_STRING;
+            op->text = p;
+            while (*p && *p != quote) {
+                p++;
+            }
+            if (*p != quote) {
+                return false;
+            }
+            op->text_len = p++ - op->text;
+        } else if (strncmp(p, "true", 4) == 0) {
+            op->literal = JEMI_TRUE;
+            p += 4;
+        } else if (strncmp(p, "false", 5) == 0) {
+            op->literal = JEMI_FALSE;
+            p += 5;
+        } else if (strncmp(p, "null", 4) == 0) {
+            op->literal = JEMI_NULL;
+            p += 4;
+        } else {
+            char *end;
+            op->literal = JEMI_FLOAT;
+            op->number = strtod(p, &end);
+            if (end == p) {
+                return false;
+            }
+            p = end;
+        }
+        while (*p == ' ') {
+            p++;
+        }
+    }
+    if (*p++ != ')') {
+        return false;
+    }
+    *path = p;
+    return true;
+}
+
+static void query_visit(query_ctx_t *ctx, jemi_node_t *node, uint8_t pc) {
+    while ((node = deref(node)) != NULL) {
+        const jemi_query_op_t *op;
+
+        if (pc == ctx->query->n_ops) {
+            ctx->matches += 1;
+            ctx->match_fn(node, ctx->arg);
+            return;
+        }
+        op = &ctx->query->ops[pc];
+        if (op->opcode == QOP_MEMBER) {
+            node = (node->type == JEMI_OBJECT)
+                       ? find_member(node, op->key, op->key_len)
+                       : NULL;
+        } else if (op->opcode == QOP_INDEX) {
+            int64_t index = op->index;
+            jemi_node_t *child = NULL;
+            if (node->type == JEMI_ARRAY) {
+                child = node->children;
+                if (index < 0) {
+                    // count from the end
+                    for (jemi_node_t *n = child; n; n = n->sibling) {
+                        index += 1;
+                    }
+                    if (index < 0) {
+                        child = NULL;
+                    }
+                }
+                while (child && index-- > 0) {
+                    child = child->sibling;
+                }
+            }
+            node = child;
+        } else {
+            // QOP_WILDCARD, QOP_DESCEND or QOP_FILTER: iterate over children
+            if ((node->type == JEMI_ARRAY || node->type == JEMI_OBJECT) &&
+                node->children) {
+                if (ctx->sp == JEMI_QUERY_MAX_DEPTH) {
+                    ctx->overflow = true;
+                    return;
+                }
+                ctx->stack[ctx->sp++] = (query_frame_t){
+                    .cursor = node->children,
+                    .pc = pc,
+                    .is_obj = node->type == JEMI_OBJECT};
+            }
+            if (op->opcode != QOP_DESCEND) {
+                return;
+            }
+            // QOP_DESCEND also applies the next op to the node itself
+        }
+        pc += 1;
+    }
+}
+
+static bool query_filter(const jemi_query_op_t *op, jemi_node_t *node) {
+    int order;
+
+    node = deref(node);
+    if (op->key) {
+        node = (node && node->type == JEMI_OBJECT)
+                   ? deref(find_member(node, op->key, op->key_len))
+                   : NULL;
+    }
+    if (node == NULL) {
+        return false;
+    } else if (op->compare == QCMP_EXISTS) {
+        return true;
+    }
+    if (op->literal == JEMI_FLOAT) {
+        double value;
+        if (node->type == JEMI_INTEGER) {
+            value = integer_value(node);
+        } else if (node->type == JEMI_FLOAT) {
+            value = node->number;
+        } else {
+            return op->compare == QCMP_NE;
+        }
+        order = (value > op->number) - (value < op->number);
+    } else if (op->literal == JEMI_STRING) {
+        if (node->type != JEMI_STRING) {
+            return op->compare == QCMP_NE;
+        }
+        size_t len = string_length(node);
+        order = memcmp(node->string, op->text,
+                       len < op->text_len ? len : op->text_len);
+        if (order == 0) {
+            order = (len > op->text_len) - (len < op->text_len);
+        }
+    } else if (node->type == op->literal) {
+        order = 0; // true, false or null
+    } else {
+        return op->compare == QCMP_NE;
+    }
+    switch (op->compare) {
+    case QCMP_EQ:
+        return order == 0;
+    case QCMP_NE:
+        return order != 0;
+    case QCMP_LT:
+        return order < 0;
+    case QCMP_LE:
+        return order <= 0;
+    case QCMP_GT:
+        return order > 0;
+    default:
+        return order >= 0; // QCMP_GE
+    }
+}
+
+static jemi_schema_op_t *schema_op(jemi_schema_t *schema, uint8_t opcode) {
+    jemi_schema_op_t *op;
+
+    if (schema->n_ops == JEMI_SCHEMA_MAX_OPS) {
+        return NULL;
+    }
+    op = &schema->ops[schema->n_ops++];
+    *op = (jemi_schema_op_t){.opcode = opcode};
+    return op;
+}
+
+static bool schema_compile_aux(jemi_schema_t *schema, jemi_node_t *node,
+                               size_t depth) {
+    node = deref(node);
+    if (node == NULL || depth == JEMI_SCHEMA_MAX_DEPTH) {
+        return false;
+    } else if (node->type == JEMI_FALSE) {
+        // no type matches an empty set of types
+        if (schema_op(schema, SOP_TYPE) == NULL) {
+            return false;
+        }
+    } else if (node->type != JEMI_TRUE && node->type != JEMI_OBJECT) {
+        return false;
+    }
+
+    for (jemi_node_t *key = (node->type == JEMI_OBJECT) ? node->children : NULL;
+         key && key->sibling; key = key->sibling->sibling) {
+        jemi_node_t *value = deref(key->sibling);
+        jemi_schema_op_t *op = NULL;
+        size_t start;
+
+        if (key->type != JEMI_STRING || value == NULL) {
+            return false;
+        } else if (string_equals(key, "type", 4)) {
+            jemi_node_t *name = value;
+            if (value->type == JEMI_ARRAY) {
+                name = value->children;
+            } else if (value->type != JEMI_STRING) {
+                return false;
+            }
+            if ((op = schema_op(schema, SOP_TYPE)) == NULL) {
+                return false;
+            }
+            // a single name, or each name in the array
+            for (; name; name = (value->type == JEMI_ARRAY) ? name->sibling
+                                                            : NULL) {
+                uint8_t bit = schema_type_bit(deref(name));
+                if (bit == 0) {
+                    return false;
+                }
+                op->types |= bit;
+            }
+        } else if (string_equals(key, "enum", 4)) {
+            if (value->type != JEMI_ARRAY ||
+                (op = schema_op(schema, SOP_ENUM)) == NULL) {
+                return false;
+            }
+            op->node = value;
+        } else if (string_equals(key, "minimum", 7) ||
+                   string_equals(key, "maximum", 7)) {
+            uint8_t opcode =
+                (key->string[1] == 'i') ? SOP_MINIMUM : SOP_MAXIMUM;
+            if ((value->type != JEMI_INTEGER && value->type != JEMI_FLOAT) ||
+                (op = schema_op(schema, opcode)) == NULL) {
+                return false;
+            }
+            op->number = (value->type == JEMI_INTEGER) ? integer_value(value)
+                                                       : value->number;
+        } else if (string_equals(key, "maxLength", 9)) {
+            if (value->type != JEMI_INTEGER || value->integer < 0 ||
+                (op = schema_op(schema, SOP_MAX_LENGTH)) == NULL) {
+                return false;
+            }
+            op->length = (size_t)value->integer;
+        } else if (string_equals(key, "required", 8)) {
+            if (value->type != JEMI_ARRAY) {
+                return false;
+            }
+            for (jemi_node_t *name = value->children; name;
+                 name = name->sibling) {
+                jemi_node_t *target = deref(name);
+                if (target == NULL || target->type != JEMI_STRING ||
+                    (op = schema_op(schema, SOP_REQUIRED)) == NULL) {
+                    return false;
+                }
+                op->node = target;
+            }
+        } else if (string_equals(key, "properties", 10)) {
+            if (value->type != JEMI_OBJECT) {
+                return false;
+            }
+            for (jemi_node_t *name = value->children; name && name->sibling;
+                 name = name->sibling->sibling) {
+                if (name->type != JEMI_STRING ||
+                    (op = schema_op(schema, SOP_PROPERTY)) == NULL) {
+                    return false;
+                }
+                op->node = name;
+                start = schema->n_ops;
+                if (!schema_compile_aux(schema, name->sibling, depth + 1)) {
+                    return false;
+                }
+                op->skip = schema->n_ops - start;
+            }
+        } else if (string_equals(key, "items", 5)) {
+            if ((op = schema_op(schema, SOP_ITEMS)) == NULL) {
+                return false;
+            }
+            start = schema->n_ops;
+            if (!schema_compile_aux(schema, value, depth + 1)) {
+                return false;
+            }
+            op->skip = schema->n_ops - start;
+        }
+        // other keywords are ignored
+    }
+    return schema_op(schema, SOP_END) != NULL;
+}
+
+static uint8_t schema_type_bit(jemi_node_t *name) {
+    static const char *const names[] = {"null",   "boolean", "object",
+                                        "array",  "number",  "string",
+                                        "integer"};
+
+    if (name == NULL || name->type != JEMI_STRING) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (string_equals(name, names[i], strlen(names[i]))) {
+            return (uint8_t)(1 << i); // STYPE_NULL through STYPE_INTEGER
+        }
+    }
+    return 0;
+}
+
+static uint8_t schema_types_of(jemi_node_t *node) {
+    switch (node->type) {
+    case JEMI_OBJECT:
+        return STYPE_OBJECT;
+    case JEMI_ARRAY:
+        return STYPE_ARRAY;
+    case JEMI_INTEGER:
+        return STYPE_NUMBER | STYPE_INTEGER;
+    case JEMI_FLOAT:
+        // a float with no fractional part is an integer too
+        if (node->number >= -9.2e18 && node->number <= 9.2e18 &&
+            (double)(int64_t)node->number == node->number) {
+            return STYPE_NUMBER | STYPE_INTEGER;
+        }
+        return STYPE_NUMBER;
+    case JEMI_STRING:
+    case JEMI_CONCAT:
+        return STYPE_STRING;
+    case JEMI_TRUE:
+    case JEMI_FALSE:
+        return STYPE_BOOLEAN;
+    case JEMI_NULL:
+        return STYPE_NULL;
+    default:
+        return 0; // spilled: the type is no longer known
+    }
+}
+
+static bool schema_check(const jemi_schema_op_t *op, jemi_node_t *node) {
+    switch (op->opcode) {
+    case SOP_TYPE:
+        return (op->types & schema_types_of(node)) != 0;
+
+    case SOP_ENUM:
+        for (jemi_node_t *value = op->node->children; value;
+             value = value->sibling) {
+            if (jemi_equal(node, value)) {
+                return true;
+            }
+        }
+        return false;
+
+    case SOP_MINIMUM:
+    case SOP_MAXIMUM: {
+        double value;
+        if (node->type == JEMI_INTEGER) {
+            value = integer_value(node);
+        } else if (node->type == JEMI_FLOAT) {
+            value = node->number;
+        } else {
+            return true; // only applies to numbers
+        }
+        return (op->opcode == SOP_MINIMUM) ? value >= op->number
+                                           : value <= op->number;
+    }
+
+    case SOP_MAX_LENGTH: {
+        size_t len, count = 0;
+        if (node->type != JEMI_STRING) {
+            return true; // only applies to strings
+        }
+        // count code points: every byte but UTF-8 continuation bytes
+        len = string_length(node);
+        for (size_t i = 0; i < len && count <= op->length; i++) {
+            count += ((uint8_t)node->string[i] & 0xc0) != 0x80;
+        }
+        return count <= op->length;
+    }
+
+    case SOP_REQUIRED:
+        return node->type != JEMI_OBJECT ||
+               find_member(node, op->node->string,
+                           string_length(op->node)) != NULL;
+
+    default:
+        return false;
+    }
+}
+
+static jemi_node_t *clone_node(jemi_node_t *node) {
+    jemi_node_t *copy = jemi_alloc(node->type);
+    if (copy) {
+        *copy = *node;
+        copy->sibling = NULL;
+    }
+    return copy;
+}
+
+static jemi_node_t *clone_changed(jemi_node_t *node) {
+    jemi_node_t *copy = clone_node(node);
+#ifdef JEMI_GENERATIONS
+    if (copy) {
+        copy->generation = s_jemi_generation;
+    }
+#endif
+    return copy;
+}
+
+static jemi_node_t *clone_prefix(jemi_node_t *list, jemi_node_t *stop,
+                                 jemi_node_t *tail) {
+    jemi_node_t *head = tail;
+    jemi_node_t *prev = NULL;
+
+    while (list != stop) {
+        jemi_node_t *copy = clone_node(list);
+        if (copy == NULL) {
+            return NULL; // out of nodes
+        }
+        if (prev == NULL) {
+            head = copy;
+        } else {
+            prev->sibling = copy;
+        }
+        prev = copy;
+        list = list->sibling;
+    }
+    if (prev) {
+        prev->sibling = tail;
+    }
+    return head;
+}
+
+static size_t persist_cost(jemi_node_t *list, bool is_obj,
+                           jemi_node_t *target, persist_op_t op, bool *found) {
+    size_t count = 0; // nodes before node in list: each is cloned
+
+    for (jemi_node_t *node = list; node; node = node->sibling, count++) {
+        if (node == target) {
+            *found = true;
+            if (op == PERSIST_APPEND) {
+                // node and all its children, counted (the cached count may
+                // be stale if they were relinked by hand)
+                size_t cost = count + 1;
+                for (jemi_node_t *child = deref(node)->children; child;
+                     child = child->sibling) {
+                    cost += 1;
+                }
+                return cost;
+            } else if (op == PERSIST_REMOVE && is_obj && (count & 1)) {
+                return count - 1; // the value's key isn't cloned either
+            }
+            return count;
+        } else if (node->type == JEMI_ARRAY || node->type == JEMI_OBJECT) {
+            size_t cost = persist_cost(node->children,
+                                       node->type == JEMI_OBJECT, target, op,
+                                       found);
+            if (*found) {
+                return count + 1 + cost; // node is cloned too
+            }
+        }
+    }
+    return 0;
+}
+
+static jemi_node_t *persist(jemi_node_t *root, jemi_node_t *target,
+                            persist_op_t op, jemi_node_t *value) {
+    persist_status_t status = PERSIST_NOT_FOUND;
+    bool found = false;
+    size_t cost = persist_cost(root, false, target, op, &found);
+    jemi_node_t *r2;
+
+    // check up front, so a low pool can't leave a partly built version behind
+    if (!found || !pool_has(cost)) {
+        return NULL;
+    }
+    r2 = persist_list(root, false, target, op, value, &status);
+    return (status == PERSIST_DONE) ? r2 : NULL;
+}
+
+static bool pool_has(size_t n) {
+    jemi_node_t *node = s_jemi_freelist;
+
+    while (n > 0 && node) {
+        n -= 1;
+        node = node->sibling;
+    }
+    return n == 0;
+}
+
+static jemi_node_t *persist_list(jemi_node_t *list, bool is_obj,
+                                 jemi_node_t *target, persist_op_t op,
+                                 jemi_node_t *value, persist_status_t *status) {
+    int count = 0;
+    jemi_node_t *prev = NULL;
+    jemi_node_t *node = list;
+
+    while (node) {
+        // [stop, tail) is the part of list that gets replaced by head
+        jemi_node_t *stop = node;
+        jemi_node_t *tail = node->sibling;
+        jemi_node_t *head = NULL;
+
+        if (node == target) {
+            *status = PERSIST_DONE;
+            if (op == PERSIST_SET && is_obj && (count & 1)) {
+                // a new copy of the key: jemi_emit_since() sends all of value
+                stop = prev;
+                if ((head = clone_changed(prev)) != NULL) {
+                    head->sibling = value;
+                    value->sibling = tail;
+                } else {
+                    *status = PERSIST_FAILED;
+                }
+            } else if (op == PERSIST_SET) {
+                value->sibling = tail;
+                head = value;
+            } else if (op == PERSIST_REMOVE) {
+                if (is_obj && (count & 1)) {
+                    stop = prev; // removing a value: remove its key as well
+                } else if (is_obj && tail) {
+                    tail = tail->sibling; // removing a key: skip its value
+                }
+                head = tail;
+            } else if ((head = clone_changed(deref(node))) != NULL) {
+                // PERSIST_APPEND: the last child gets a new sibling, so the
+                // entire list of children must be copied (and a reference is
+                // replaced by a copy of the container it refers to).
+                jemi_node_t *children = deref(node)->children;
+                head->children = clone_prefix(children, NULL, value);
+                head->sibling = tail;
+                head->length = 0;
+                adopt(head, head->children);
+                stamp_list(value);
+                if (children && head->children == NULL) {
+                    *status = PERSIST_FAILED;
+                }
+            } else {
+                *status = PERSIST_FAILED;
+            }
+        } else if (node->type == JEMI_ARRAY || node->type == JEMI_OBJECT) {
+            jemi_node_t *children =
+                persist_list(node->children, node->type == JEMI_OBJECT, target,
+                             op, value, status);
+            if (*status == PERSIST_DONE) {
+                if ((head = clone_changed(node)) != NULL) {
+                    head->children = children;
+                    head->sibling = tail;
+                    head->length = 0;
+                    adopt(head, head->children);
+                } else {
+                    *status = PERSIST_FAILED;
+                }
+            }
+        }
+        if (*status == PERSIST_FAILED) {
+            return NULL;
+        } else if (*status == PERSIST_DONE) {
+            jemi_node_t *r2 = clone_prefix(list, stop, head);
+            if (r2 == NULL && list != stop) {
+                *status = PERSIST_FAILED;
+            }
+            return r2;
+        }
+        count += 1;
+        prev = node;
+        node = node->sibling;
+    }
+    return list;
+}
+
+static void emit_char(emit_ctx_t *ctx, char ch) {
+    if (ctx->chunk_fn) {
+        if (ctx->len == JEMI_CHUNK_SIZE) {
+            emit_flush(ctx);
+        }
+        ctx->buf[ctx->len++] = ch;
+    } else {
+        ctx->writer_fn(ch, ctx->arg);
+    }
+    ctx->count += 1;
+}
+
+static void emit_chars(emit_ctx_t *ctx, const char *buf, size_t len) {
+    if (ctx->chunk_fn == NULL) {
+        for (size_t i = 0; i < len; i++) {
+            ctx->writer_fn(buf[i], ctx->arg);
+        }
+    } else if (ctx->len + len <= JEMI_CHUNK_SIZE) {
+        memcpy(&ctx->buf[ctx->len], buf, len);
+        ctx->len += len;
+    } else {
+        // doesn't fit: flush, then stage buf or pass it through directly
+        emit_flush(ctx);
+        if (len <= JEMI_CHUNK_SIZE) {
+            memcpy(ctx->buf, buf, len);
+            ctx->len = len;
+        } else {
+            ctx->chunk_fn(buf, len, ctx->arg);
+        }
+    }
+    ctx->count += len;
+}
+
+static void emit_flush(emit_ctx_t *ctx) {
+    if (ctx->len > 0) {
+        ctx->chunk_fn(ctx->buf, ctx->len, ctx->arg);
+        ctx->len = 0;
+    }
+}
+
+static void emit_string(emit_ctx_t *ctx, const char *buf) {
+    emit_chars(ctx, buf, strlen(buf));
+}
+
+static void emit_escaped(emit_ctx_t *ctx, const char *buf, size_t len) {
+    const char *run = buf;
+    const char *end = buf + len;
+    unsigned char ch;
+
+    // emit runs of plain characters in one go, escapes individually
+    for (; buf < end; buf++) {
+        ch = *buf;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        emit_chars(ctx, run, buf - run);
+        run = buf + 1;
+        emit_char(ctx, '\\');
+        switch (ch) {
+        case '"':
+        case '\\':
+            emit_char(ctx, ch);
+            break;
+        case '\b':
+            emit_char(ctx, 'b');
+            break;
+        case '\f':
+            emit_char(ctx, 'f');
+            break;
+        case '\n':
+            emit_char(ctx, 'n');
+            break;
+        case '\r':
+            emit_char(ctx, 'r');
+            break;
+        case '\t':
+            emit_char(ctx, 't');
+            break;
+        default: {
+            char hex[] = {'u', '0', '0', "0123456789abcdef"[ch >> 4],
+                          "0123456789abcdef"[ch & 0xf]};
+            emit_chars(ctx, hex, sizeof(hex));
+        }
+        }
+    }
+    emit_chars(ctx, run, buf - run);
+}
+
+static void emit_concat(emit_ctx_t *ctx, jemi_node_t *parts) {
+    for (jemi_node_t *part = parts; part; part = part->sibling) {
+        jemi_node_t *node = deref(part);
+        if (node == NULL) {
+            continue;
+        }
+        switch (node->type) {
+        case JEMI_STRING: {
+            emit_escaped(ctx, node->string, string_length(node));
+        } break;
+        case JEMI_FLOAT:
+        case JEMI_INTEGER: {
+            emit_number(ctx, node);
+        } break;
+        case JEMI_CONCAT: {
+            emit_concat(ctx, node->children);
+        } break;
+        default: {
+            // other types contribute nothing
+        }
+        }
+    }
+}
+
+static void emit_spilled(emit_ctx_t *ctx, jemi_node_t *node) {
+    char buf[JEMI_CHUNK_SIZE];
+    size_t offset = node->spill.offset;
+    size_t end = offset + node->spill.length;
+
+    while (offset < end) {
+        const char *data = buf;
+        size_t n = s_jemi_spill.read_fn(offset, end - offset, buf, &data,
+                                        s_jemi_spill.arg);
+        if (n == 0) {
+            break; // read error: nothing more can be done
+        }
+        // large blocks in *data are passed through to a chunk_fn uncopied
+        emit_chars(ctx, data, n);
+        offset += n;
+    }
+}
+
+static emit_ctx_t sw_ctx(jemi_sw_t *sw) {
+    emit_ctx_t ctx = {
+        .chunk_fn = sw->chunk_fn, .arg = sw->arg, .buf = sw->buf, .len = sw->len};
+    return ctx;
+}
+
+static emit_ctx_t sw_begin_value(jemi_sw_t *sw) {
+    emit_ctx_t ctx = sw_ctx(sw);
+    uint8_t state = sw->state[sw->depth];
+
+    if ((state & SW_NONEMPTY) && !(state & SW_KEY)) {
+        emit_char(&ctx, ',');
+    }
+    return ctx;
+}
+
+static void sw_end_value(jemi_sw_t *sw, emit_ctx_t *ctx) {
+    sw->state[sw->depth] &= ~SW_KEY;
+    sw->state[sw->depth] |= SW_NONEMPTY;
+    sw->len = ctx->len;
+    if (sw->depth == 0) {
+        jemi_sw_flush(sw);
+    }
+}
+
+static void sw_begin_container(jemi_sw_t *sw, char ch, uint8_t state) {
+    emit_ctx_t ctx;
+
+    if (sw->skip == 0 && sw->depth + 1 < JEMI_SW_MAX_DEPTH) {
+        ctx = sw_begin_value(sw);
+        emit_char(&ctx, ch);
+        sw->len = ctx.len;
+        sw->state[++sw->depth] = state;
+        return;
+    }
+    if (sw->skip == 0) {
+        jemi_sw_null(sw); // too deep: stands in for the whole container
+        sw->truncated = true;
+    }
+    sw->skip += 1;
+}
+
+static void cbor_head(emit_ctx_t *ctx, uint8_t major, uint64_t value) {
+    char head[9];
+    size_t n;
+
+    if (value < 24) {
+        head[0] = (char)(major | value);
+        n = 1;
+    } else if (value <= 0xff) {
+        head[0] = (char)(major | 24);
+        n = 2;
+    } else if (value <= 0xffff) {
+        head[0] = (char)(major | 25);
+        n = 3;
+    } else if (value <= 0xffffffff) {
+        head[0] = (char)(major | 26);
+        n = 5;
+    } else {
+        head[0] = (char)(major | 27);
+        n = 9;
+    }
+    // argument follows in big-endian order
+    for (size_t i = n - 1; i > 0; i--) {
+        head[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+    emit_chars(ctx, head, n);
+}
+
+static void cbor_float(emit_ctx_t *ctx, double value) {
+    char bytes[9];
+    uint64_t bits;
+    size_t n;
+
+    if (value >= -FLT_MAX && value <= FLT_MAX && (double)(float)value == value) {
+        float single = (float)value;
+        uint32_t bits32;
+        memcpy(&bits32, &single, sizeof(bits32));
+        bits = bits32;
+        bytes[0] = (char)CBOR_FLOAT32;
+        n = 5;
+    } else {
+        memcpy(&bits, &value, sizeof(bits));
+        bytes[0] = (char)CBOR_FLOAT64;
+        n = 9;
+    }
+    for (size_t i = n - 1; i > 0; i--) {
+        bytes[i] = (char)(bits & 0xff);
+        bits >>= 8;
+    }
+    emit_chars(ctx, bytes, n);
+}
+
+static size_t cbor_decode(const uint8_t *buf, size_t len, jemi_node_t **root) {
+    cbor_frame_t stack[JEMI_CBOR_MAX_DEPTH];
+    size_t depth = 0;
+    size_t n_nodes = 0;
+    jemi_node_t scratch; // stands in for every node when only counting
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+
+    while (true) {
+        // close containers that have all their items
+        while (depth > 0 && !stack[depth - 1].indefinite &&
+               stack[depth - 1].remaining == 0) {
+            depth -= 1;
+        }
+        if (depth == 0 && n_nodes > 0) {
+            break; // done
+        }
+        if (p == end) {
+            goto fail; // truncated
+        }
+
+        uint8_t major = *p & 0xe0;
+        uint8_t info = *p++ & 0x1f;
+        uint64_t value;
+        jemi_node_t *node;
+
+        if (major == CBOR_SIMPLE && info == CBOR_INDEFINITE) {
+            // a break ends an indefinite container, but not mid key/value pair
+            if (depth == 0 || !stack[depth - 1].indefinite ||
+                (stack[depth - 1].is_map && (stack[depth - 1].remaining & 1))) {
+                goto fail;
+            }
+            depth -= 1;
+            continue;
+        }
+        if ((info == CBOR_INDEFINITE && major != CBOR_ARRAY &&
+             major != CBOR_MAP) ||
+            !cbor_argument(&p, end, info, &value)) {
+            goto fail; // malformed, or a chunked string
+        }
+        if (major == CBOR_TAG) {
+            continue; // decode the tagged item as if it had no tag
+        }
+        if (depth > 0 && stack[depth - 1].is_map &&
+            (stack[depth - 1].remaining & 1) == 0 && major != CBOR_TEXT) {
+            goto fail; // JSON object keys must be strings
+        }
+        bool is_container = major == CBOR_ARRAY || major == CBOR_MAP;
+        if (is_container &&
+            (depth == JEMI_CBOR_MAX_DEPTH ||
+             (info != CBOR_INDEFINITE && value > (uint64_t)(end - p)))) {
+            goto fail; // too deep, or more items than bytes left
+        }
+        if ((node = root ? jemi_alloc(JEMI_NULL) : &scratch) == NULL) {
+            goto fail; // out of nodes
+        }
+        if (is_container) {
+            node->type = (major == CBOR_MAP) ? JEMI_OBJECT : JEMI_ARRAY;
+            node->children = NULL;
+        } else if (!cbor_scalar(&p, end, major, info, value, node)) {
+            if (node != &scratch) {
+                jemi_free(node);
+            }
+            goto fail;
+        }
+        n_nodes += 1;
+
+        // add node to the innermost container (or make it the root)
+        if (depth == 0) {
+            if (root) {
+                *root = node;
+            }
+        } else {
+            cbor_frame_t *top = &stack[depth - 1];
+            if (root) {
+                if (top->last) {
+                    top->last->sibling = node;
+                } else {
+                    top->container->children = node;
+                }
+                adopt(top->container, node);
+            }
+            top->last = node;
+            top->remaining -= 1; // for indefinite containers, tracks parity
+        }
+
+        if (node->type == JEMI_ARRAY || node->type == JEMI_OBJECT) {
+            bool is_map = node->type == JEMI_OBJECT;
+            stack[depth++] = (cbor_frame_t){
+                .container = node,
+                .last = NULL,
+                .remaining = is_map ? 2 * value : value,
+                .indefinite = info == CBOR_INDEFINITE,
+                .is_map = is_map};
+        }
+    }
+    if (p == end) {
+        return n_nodes;
+    }
+fail:
+    if (root) {
+        jemi_free(*root);
+        *root = NULL;
+    }
+    return 0;
+}
+
+static bool cbor_argument(const uint8_t **p, const uint8_t *end, uint8_t info,
+                          uint64_t *value) {
+    size_t n;
+
+    if (info < 24) {
+        *value = info;
+        return true;
+    } else if (info == CBOR_INDEFINITE) {
+        *value = 0;
+        return true; // validity depends on the major type
+    } else if (info > 27) {
+        return false; // reserved
+    }
+    n = (size_t)1 << (info - 24); // 1, 2, 4 or 8 bytes, big-endian
+    if ((size_t)(end - *p) < n) {
+        return false;
+    }
+    *value = 0;
+    while (n-- > 0) {
+        *value = (*value << 8) | *(*p)++;
+    }
+    return true;
+}
+
+static bool cbor_scalar(const uint8_t **p, const uint8_t *end, uint8_t major,
+                        uint8_t info, uint64_t value, jemi_node_t *node) {
+    switch (major) {
+    case CBOR_UINT:
+        node->type = JEMI_INTEGER;
+        node->integer = (int64_t)value;
+        node->length = (value > INT64_MAX); // held as a uint64_t
+        return true;
+
+    case CBOR_NEGINT:
+        if (value > INT64_MAX) {
+            node->type = JEMI_FLOAT;
+            node->number = -1.0 - (double)value;
+        } else {
+            node->type = JEMI_INTEGER;
+            node->integer = -1 - (int64_t)value;
+        }
+        return true;
+
+    case CBOR_TEXT:
+        if (value > (uint64_t)(end - *p) || value >= JEMI_STRING_MAX_LENGTH) {
+            return false;
+        }
+        // refer to the string in place rather than copying it (as with
+        // jemi_string_n(), an empty string can't be left unterminated)
+        node->type = JEMI_STRING;
+        node->string = (value > 0) ? (const char *)*p : "";
+        node->length = value;
+        for (size_t i = 0; i < value; i++) {
+            if ((*p)[i] < 0x20 || (*p)[i] == '"' || (*p)[i] == '\\') {
+                node->length |= JEMI_STRING_RAW; // escape it when emitted
+                break;
+            }
+        }
+        *p += value;
+        return true;
+
+    case CBOR_SIMPLE:
+        switch (info) {
+        case CBOR_FALSE & 0x1f:
+            node->type = JEMI_FALSE;
+            return true;
+        case CBOR_TRUE & 0x1f:
+            node->type = JEMI_TRUE;
+            return true;
+        case CBOR_NULL & 0x1f:
+        case (CBOR_NULL & 0x1f) + 1: // undefined
+            node->type = JEMI_NULL;
+            return true;
+        case 25:
+            node->type = JEMI_FLOAT;
+            node->number = half_to_float((uint16_t)value);
+            break;
+        case CBOR_FLOAT32 & 0x1f: {
+            uint32_t bits = (uint32_t)value;
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            node->type = JEMI_FLOAT;
+            node->number = single;
+        } break;
+        case CBOR_FLOAT64 & 0x1f:
+            node->type = JEMI_FLOAT;
+            memcpy(&node->number, &value, sizeof(node->number));
+            break;
+        default:
+            return false; // other simple values have no JSON equivalent
+        }
+        return isfinite(node->number); // JSON has no NaN or Infinity
+
+    default:
+        return false; // byte strings have no JSON equivalent
+    }
+}
+
+static float half_to_float(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    float result;
+
+    if (exponent == 0) {
+        // zero or subnormal: exactly mantissa * 2^-24
+        result = (float)mantissa / 16777216.0f;
+        return sign ? -result : result;
+    } else if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13); // infinity or NaN
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static bool json_text(emit_ctx_t *ctx, const char **p, const char *end) {
+    const char *start = *p;
+    size_t len;
+
+    // CBOR needs the length up front: measure, then write
+    if (!json_string(NULL, p, end, &len)) {
+        return false;
+    }
+    cbor_head(ctx, CBOR_TEXT, len);
+    return json_string(ctx, &start, end, &len);
+}
+
+static bool json_string(emit_ctx_t *ctx, const char **p, const char *end,
+                        size_t *len) {
+    const char *s = *p;
+    const char *run = s; // start of unescaped chars not yet written
+    size_t n = 0;
+
+    while (true) {
+        if (s == end) {
+            return false; // unterminated
+        }
+        unsigned char ch = *s;
+        if (ch != '"' && ch != '\\' && ch >= 0x20) {
+            s += 1;
+            continue;
+        }
+        if (ctx) {
+            emit_chars(ctx, run, s - run);
+        }
+        n += s - run;
+        if (ch == '"') {
+            break;
+        } else if (ch < 0x20 || end - s < 2) {
+            return false; // control char or truncated escape
+        }
+        char utf8[4];
+        size_t u = 1;
+        switch (s[1]) {
+        case '"':
+        case '\\':
+        case '/':
+            utf8[0] = s[1];
+            break;
+        case 'b':
+            utf8[0] = '\b';
+            break;
+        case 'f':
+            utf8[0] = '\f';
+            break;
+        case 'n':
+            utf8[0] = '\n';
+            break;
+        case 'r':
+            utf8[0] = '\r';
+            break;
+        case 't':
+            utf8[0] = '\t';
+            break;
+        case 'u': {
+            uint32_t code_point, low;
+            if (!json_hex4(s + 2, end, &code_point)) {
+                return false;
+            }
+            if (code_point >= 0xd800 && code_point < 0xdc00) {
+                // high surrogate: must be followed by a low surrogate
+                s += 6;
+                if (end - s < 2 || s[0] != '\\' || s[1] != 'u' ||
+                    !json_hex4(s + 2, end, &low) || low < 0xdc00 ||
+                    low >= 0xe000) {
+                    return false;
+                }
+                code_point = 0x10000 + ((code_point - 0xd800) << 10) +
+                             (low - 0xdc00);
+            } else if (code_point >= 0xdc00 && code_point < 0xe000) {
+                return false; // unpaired low surrogate
+            }
+            u = utf8_encode(utf8, code_point);
+            s += 4; // plus the two below
+        } break;
+        default:
+            return false;
+        }
+        s += 2;
+        if (ctx) {
+            emit_chars(ctx, utf8, u);
+        }
+        n += u;
+        run = s;
+    }
+    *p = s + 1;
+    *len = n;
+    return true;
+}
+
+static bool json_number(emit_ctx_t *ctx, const char **p, const char *end) {
+    const char *s = *p;
+    bool negative = false;
+    bool is_int = true;
+    bool overflow = false;
+    uint64_t u = 0;
+
+    if (*s == '-') {
+        negative = true;
+        s += 1;
+    }
+    if (s == end || *s < '0' || *s > '9' ||
+        (*s == '0' && end - s > 1 && s[1] >= '0' && s[1] <= '9')) {
+        return false; // no digits, or a leading zero
+    }
+    for (; s < end && *s >= '0' && *s <= '9'; s++) {
+        uint64_t digit = *s - '0';
+        if (u > (UINT64_MAX - digit) / 10) {
+            overflow = true;
+        } else {
+            u = u * 10 + digit;
+        }
+    }
+    if (s < end && *s == '.') {
+        is_int = false;
+        if (++s == end || *s < '0' || *s > '9') {
+            return false;
+        }
+        while (s < end && *s >= '0' && *s <= '9') {
+            s += 1;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        is_int = false;
+        s += 1;
+        if (s < end && (*s == '+' || *s == '-')) {
+            s += 1;
+        }
+        if (s == end || *s < '0' || *s > '9') {
+            return false;
+        }
+        while (s < end && *s >= '0' && *s <= '9') {
+            s += 1;
+        }
+    }
+
+    if (is_int && !overflow) {
+        if (negative && u > 0) {
+            cbor_head(ctx, CBOR_NEGINT, u - 1); // CBOR encodes -1 - n
+        } else {
+            cbor_head(ctx, CBOR_UINT, u);
+        }
+    } else {
+        double number;
+        if (s < end) {
+            // the byte after the number stops strtod(), so convert it in place
+            char *stop;
+            number = strtod(*p, &stop);
+            if (stop != s) {
+                return false; // e.g. a locale with a different decimal point
+            }
+        } else {
+            number = json_number_tail(*p, s);
+        }
+        if (!isfinite(number)) {
+            return false; // e.g. 1e400, which JSON can't express as Infinity
+        }
+        cbor_float(ctx, number);
+    }
+    *p = s;
+    return true;
+}
+
+static double json_number_tail(const char *p, const char *end) {
+    // sign, up to 40 significant digits, a sticky digit and an exponent
+    char text[56];
+    size_t n = 0;
+    size_t digits = 0;
+    long exponent = 0;
+    long e = 0;
+    bool fraction = false;
+    bool sticky = false; // a non-zero digit was dropped
+
+    if (*p == '-') {
+        text[n++] = *p++;
+    }
+    for (; p < end && *p != 'e' && *p != 'E'; p++) {
+        if (*p == '.') {
+            fraction = true;
+        } else if (digits == 0 && *p == '0') {
+            exponent -= fraction; // leading zeros are not significant
+        } else if (digits < 40) {
+            text[n++] = *p;
+            digits += 1;
+            exponent -= fraction;
+        } else {
+            exponent += !fraction;
+            sticky |= *p != '0';
+        }
+    }
+    if (sticky) {
+        text[n++] = '1'; // keeps the value above a rounding boundary
+        exponent -= 1;
+    } else if (digits == 0) {
+        text[n++] = '0';
+    }
+    if (p < end) {
+        bool negative = *++p == '-';
+        p += (*p == '-' || *p == '+');
+        for (; p < end; p++) {
+            if (e < 100000) {
+                e = e * 10 + (*p - '0'); // saturates far beyond DBL_MAX
+            }
+        }
+        exponent += negative ? -e : e;
+    }
+    snprintf(&text[n], sizeof(text) - n, "e%ld", exponent);
+    return strtod(text, NULL);
+}
+
+static bool json_literal(emit_ctx_t *ctx, const char **p, const char *end) {
+    static const char *const texts[] = {"true", "false", "null"};
+    static const uint8_t codes[] = {CBOR_TRUE, CBOR_FALSE, CBOR_NULL};
+
+    for (size_t i = 0; i < sizeof(codes); i++) {
+        size_t len = strlen(texts[i]);
+        if ((size_t)(end - *p) >= len && memcmp(*p, texts[i], len) == 0) {
+            emit_char(ctx, (char)codes[i]);
+            *p += len;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool json_hex4(const char *p, const char *end, uint32_t *value) {
+    *value = 0;
+    if (end - p < 4) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        char ch = p[i];
+        uint32_t digit;
+        if (ch >= '0' && ch <= '9') {
+            digit = ch - '0';
+        } else if (ch >= 'a' && ch <= 'f') {
+            digit = ch - 'a' + 10;
+        } else if (ch >= 'A' && ch <= 'F') {
+            digit = ch - 'A' + 10;
+        } else {
+            return false;
+        }
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+static size_t utf8_encode(char *buf, uint32_t code_point) {
+    if (code_point < 0x80) {
+        buf[0] = (char)code_point;
+        return 1;
+    } else if (code_point < 0x800) {
+        buf[0] = (char)(0xc0 | (code_point >> 6));
+        buf[1] = (char)(0x80 | (code_point & 0x3f));
+        return 2;
+    } else if (code_point < 0x10000) {
+        buf[0] = (char)(0xe0 | (code_point >> 12));
+        buf[1] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+        buf[2] = (char)(0x80 | (code_point & 0x3f));
+        return 3;
+    } else {
+        buf[0] = (char)(0xf0 | (code_point >> 18));
+        buf[1] = (char)(0x80 | ((code_point >> 12) & 0x3f));
+        buf[2] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+        buf[3] = (char)(0x80 | (code_point & 0x3f));
+        return 4;
     }
 }
 
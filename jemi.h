@@ -59,18 +59,35 @@ typedef enum {
     JEMI_STRING,
     JEMI_TRUE,
     JEMI_FALSE,
-    JEMI_NULL
+    JEMI_NULL,
+    JEMI_REF,
+    JEMI_CONCAT,
+    JEMI_SPILLED
 } jemi_type_t;
 
 typedef struct _jemi_node {
     struct _jemi_node *sibling; // any object may have siblings...
-    jemi_type_t type;
+    uint8_t type;         // a jemi_type_t, held in a byte
+    uint32_t length : 24; // for JEMI_STRING: length, or 0 if null terminated
+                          // (plus JEMI_STRING_RAW if it needs escaping);
+                          // for containers: number of children;
+                          // for JEMI_INTEGER: 1 if integer holds a uint64_t
+                          // above INT64_MAX (decoded from CBOR), else 0
     union {
-        struct _jemi_node *children; // for JEMI_ARRAY or JEMI_OBJECT
+        struct _jemi_node *children; // for JEMI_ARRAY, JEMI_OBJECT, JEMI_CONCAT
         double number;               // for JEMI_FLOAT
         int64_t integer;             // for JEMI_INTEGER
         const char *string;          // for JEMI_STRING
+        struct _jemi_node *ref;      // for JEMI_REF
+        struct {
+            uint32_t offset; // for JEMI_SPILLED: where the bytes were spilled
+            uint32_t length; // ... and how many there are
+        } spill;
     };
+#ifdef JEMI_GENERATIONS
+    struct _jemi_node *parent; // containing array or object (or NULL)
+    uint32_t generation;       // generation in which this node last changed
+#endif
 } jemi_node_t;
 
 /**
@@ -79,6 +96,207 @@ typedef struct _jemi_node {
  */
 typedef void (*jemi_writer_t)(char ch, void *arg);
 
+/**
+ * @brief Signature for a user-supplied chunked writer: it will be called with
+ * a buffer of len chars (not null terminated) and a void * pointer to a
+ * user-supplied argument.
+ */
+typedef void (*jemi_chunk_writer_t)(const char *buf, size_t len, void *arg);
+
+#ifndef JEMI_CHUNK_SIZE
+#define JEMI_CHUNK_SIZE 64 // bytes staged before calling a jemi_chunk_writer_t
+#endif
+
+#ifndef JEMI_SW_MAX_DEPTH
+#define JEMI_SW_MAX_DEPTH 16 // maximum nesting for the streaming writer
+#endif
+
+/**
+ * @brief State of a streaming writer.  Treat as opaque.
+ */
+typedef struct {
+    jemi_chunk_writer_t chunk_fn;
+    void *arg;
+    uint8_t depth;                    // current nesting level
+    uint8_t state[JEMI_SW_MAX_DEPTH]; // per level: object? empty? key?
+    size_t skip;                      // levels opened past max depth
+    bool truncated;                   // a container was replaced by null
+    size_t len;                       // number of bytes staged in buf
+    char buf[JEMI_CHUNK_SIZE];
+} jemi_sw_t;
+
+/**
+ * @brief A fixed-width slot in serialized output, for use with
+ * jemi_emit_slots() and jemi_slot_set_int().
+ */
+typedef struct {
+    jemi_node_t *node; // the JEMI_INTEGER or JEMI_FLOAT node to render
+    uint8_t width;     // slot width in bytes (widened if the value won't fit,
+                       // or set to 0 if it won't fit in 255 bytes)
+    char pad;          // ' ' (leading whitespace) or '0' (leading zeros)
+    size_t offset;     // set by jemi_emit_slots(): byte offset of the slot
+} jemi_slot_t;
+
+#define JEMI_STRING_MAX_LENGTH 0x800000 // limit for jemi_string_n()
+#define JEMI_STRING_RAW 0x800000 // length flag: escape the string when emitted
+
+#ifndef JEMI_CBOR_MAX_DEPTH
+#define JEMI_CBOR_MAX_DEPTH 16 // maximum nesting for jemi_json_to_cbor()
+#endif
+
+/**
+ * @brief Layout for jemi_emit_pretty() and jemi_emit_pretty_chunked().
+ */
+typedef struct {
+    uint8_t indent;      // indent_chars per nesting level
+    char indent_char;    // ' ' or '\t'
+    const char *newline; // "\n" or "\r\n"
+} jemi_pretty_t;
+
+#ifndef JEMI_QUERY_MAX_OPS
+#define JEMI_QUERY_MAX_OPS 16 // maximum number of steps in a compiled query
+#endif
+
+#ifndef JEMI_QUERY_MAX_DEPTH
+#define JEMI_QUERY_MAX_DEPTH 16 // maximum nesting while running a query
+#endif
+
+/**
+ * @brief One instruction of a compiled JSONPath query.  Treat as opaque.
+ */
+typedef struct {
+    uint8_t opcode;    // what this step does
+    uint8_t compare;   // filter comparison operator
+    uint8_t literal;   // jemi_type_t of the filter literal
+    uint16_t key_len;  // length of key
+    uint16_t text_len; // length of text (string literal)
+    const char *key;   // member name (not null terminated)
+    union {
+        int64_t index;    // array index
+        double number;    // numeric literal
+        const char *text; // string literal (not null terminated)
+    };
+} jemi_query_op_t;
+
+/**
+ * @brief A compiled JSONPath query, created by jemi_query_compile().
+ */
+typedef struct {
+    jemi_query_op_t ops[JEMI_QUERY_MAX_OPS];
+    size_t n_ops;
+} jemi_query_t;
+
+#ifndef JEMI_SCHEMA_MAX_OPS
+#define JEMI_SCHEMA_MAX_OPS 64 // maximum number of ops in a compiled schema
+#endif
+
+#ifndef JEMI_SCHEMA_MAX_DEPTH
+#define JEMI_SCHEMA_MAX_DEPTH 16 // maximum nesting of subschemas
+#endif
+
+/**
+ * @brief One instruction of a compiled JSON Schema.  Treat as opaque.
+ */
+typedef struct {
+    uint8_t opcode; // what this op checks
+    uint8_t types;  // for "type": bit mask of the allowed types
+    uint16_t skip;  // for "items" and "properties": ops in the subschema
+    union {
+        double number;     // for "minimum" and "maximum"
+        size_t length;     // for "maxLength"
+        jemi_node_t *node; // key for "required" and "properties", array for
+                           // "enum"
+    };
+} jemi_schema_op_t;
+
+/**
+ * @brief A compiled JSON Schema, created by jemi_schema_compile().
+ */
+typedef struct {
+    jemi_schema_op_t ops[JEMI_SCHEMA_MAX_OPS];
+    size_t n_ops;
+} jemi_schema_t;
+
+/**
+ * @brief A block of nodes set aside from the pool for use by one thread.  See
+ * jemi_subpool_init().
+ */
+typedef struct {
+    jemi_node_t *freelist; // nodes available to this subpool
+} jemi_subpool_t;
+
+/**
+ * @brief Signature for reading spilled bytes back (see jemi_spill_init()): get
+ * up to len bytes starting at offset, either by reading at most
+ * JEMI_CHUNK_SIZE of them into buf or by pointing *data at them (e.g. in a
+ * memory-mapped file).  Returns the number of bytes read, 0 on error.
+ */
+typedef size_t (*jemi_spill_reader_t)(size_t offset, size_t len, char *buf,
+                                      const char **data, void *arg);
+
+/**
+ * @brief Signature for the user-supplied function that jemi_query_run() calls
+ * for each matching node.
+ */
+typedef void (*jemi_match_fn_t)(jemi_node_t *node, void *arg);
+
+/**
+ * @brief Events reported by jemi_iter_next().
+ */
+typedef enum {
+    JEMI_ITER_ENTER, // node is an array or object: its children follow
+    JEMI_ITER_LEAVE, // all children of node have been visited
+    JEMI_ITER_LEAF,  // node is any other type
+    JEMI_ITER_DONE,  // the walk is complete
+} jemi_iter_event_t;
+
+/**
+ * @brief One level of a jemi_iter_t stack.  Treat as opaque.
+ */
+typedef struct {
+    jemi_node_t *container; // array or object being visited
+    jemi_node_t *key;       // its key (or NULL)
+    jemi_node_t *cursor;    // next child to visit
+} jemi_iter_frame_t;
+
+/**
+ * @brief State of a walk over a structure.  node, key and level describe the
+ * latest event; the remaining fields should be treated as opaque.
+ */
+typedef struct {
+    jemi_node_t *node;  // node of the latest event
+    jemi_node_t *key;   // its key if node is an object member, else NULL
+    size_t level;       // nesting level of node: 0 for the root
+    bool overflow;      // set if a container nested too deeply was skipped
+    jemi_iter_event_t event;
+    bool leave_next;    // report LEAVE for node without visiting its children
+    jemi_node_t *root;  // not yet visited, or NULL
+    jemi_iter_frame_t *stack;
+    size_t max_depth;
+    size_t depth;
+} jemi_iter_t;
+
+/**
+ * @brief Pool usage of a structure, reported by jemi_footprint().
+ */
+typedef struct {
+    size_t nodes;                     // nodes in the structure
+    size_t by_type[JEMI_SPILLED + 1]; // ... of each jemi_type_t
+    size_t string_bytes;              // bytes of text referenced by strings
+    size_t spilled_bytes;             // bytes moved to storage by jemi_spill()
+    size_t max_depth;                 // deepest nesting (0 for a scalar)
+    size_t max_fanout; // most elements or members of any array or object
+} jemi_footprint_t;
+
+/**
+ * @brief The state of a pool node, reported by jemi_pool_dump().
+ */
+typedef enum {
+    JEMI_POOL_LEAKED, // neither free nor reachable from a root
+    JEMI_POOL_FREE,   // on the freelist
+    JEMI_POOL_LIVE,   // reachable from a root
+} jemi_pool_state_t;
+
 // *****************************************************************************
 // Public declarations
 
@@ -104,11 +322,21 @@ void jemi_init(jemi_node_t *pool, size_t pool_size);
  */
 void jemi_reset(void);
 
+/**
+ * @brief Release a node and its children (but not its siblings) back to the
+ * pool.
+ *
+ * NOTE: the node must already be unlinked from any structure, and none of its
+ * children may be shared with another structure.
+ */
+void jemi_free(jemi_node_t *node);
+
 // ******************************
 // Creating JSON elements
 
 /**
- * @brief Create an JSON array with zero or more sub-elements.
+ * @brief Create an JSON array with zero or more sub-elements.  Returns NULL if
+ * the pool is exhausted.
  *
  * NOTE: NULL must always be the last argument.  If you want to
  * create an array of zero elements (e.g. for subsequent calls to
@@ -118,6 +346,7 @@ jemi_node_t *jemi_array(jemi_node_t *element, ...);
 
 /**
  * @brief Create a JSON object with zero or more key/value sub-elements.
+ * Returns NULL if the pool is exhausted.
  *
  * NOTE: NULL must always be the last argument.  If you want to
  * create an object of zero elements (e.g. for subsequent calls to
@@ -132,6 +361,51 @@ jemi_node_t *jemi_object(jemi_node_t *element, ...);
  */
 jemi_node_t *jemi_list(jemi_node_t *element, ...);
 
+/**
+ * @brief Create a JSON array of n integers.
+ *
+ * All n + 1 nodes are taken from the pool at once: if fewer are available,
+ * this returns NULL and takes none.
+ */
+jemi_node_t *jemi_array_from_ints(const int64_t *values, size_t n);
+
+/**
+ * @brief Create a JSON array of n floats.  See jemi_array_from_ints().
+ */
+jemi_node_t *jemi_array_from_floats(const double *values, size_t n);
+
+/**
+ * @brief Create a JSON array of n strings.  See jemi_array_from_ints().
+ *
+ * NOTE: the strings are not copied and must be null-terminated.
+ */
+jemi_node_t *jemi_array_from_strings(const char *const *values, size_t n);
+
+/**
+ * @brief Create a JSON object from n keys and n values.
+ *
+ * The n + 1 new nodes are taken from the pool at once: if fewer are available,
+ * or any of the values is NULL, this returns NULL and takes none (nor modifies
+ * values).
+ *
+ * NOTE: the keys are not copied, so a static table of keys is shared by every
+ * object built from it.
+ */
+jemi_node_t *jemi_object_from_table(const char *const *keys,
+                                    jemi_node_t *const *values, size_t n);
+
+/**
+ * @brief Create a JSON object from n keys and a C array of n values.
+ *
+ * type selects how values is interpreted: JEMI_INTEGER (int64_t), JEMI_FLOAT
+ * (double), JEMI_STRING (const char *) or JEMI_TRUE (bool); any other type
+ * returns NULL.  All 2n + 1 nodes are taken from the pool at once, as with
+ * jemi_object_from_table().
+ */
+jemi_node_t *jemi_object_from_column(const char *const *keys,
+                                     jemi_type_t type, const void *values,
+                                     size_t n);
+
 /**
  * @brief Create a JSON float.  This will render using %f, so it will include
  * six trailing zeroes.
@@ -151,6 +425,26 @@ jemi_node_t *jemi_integer(int64_t value);
  */
 jemi_node_t *jemi_string(const char *string);
 
+/**
+ * @brief Create a JSON string from the first len chars of string, which need
+ * not be null-terminated (e.g. a string in a received message).  Returns NULL
+ * (allocating nothing) unless len is less than JEMI_STRING_MAX_LENGTH.
+ */
+jemi_node_t *jemi_string_n(const char *string, size_t len);
+
+/**
+ * @brief Create a JSON string composed of parts, formatted directly into the
+ * output when emitted.  Parts may be strings, integers, floats or other
+ * concatenated strings (references to any of those are followed).  Other node
+ * types contribute nothing.  The final argument must be NULL.
+ *
+ * Example: jemi_concat(jemi_string("sensor-"), jemi_integer(id), NULL)
+ * renders as "sensor-12" without needing a buffer to hold the string.
+ *
+ * Unlike jemi_string(), the content of each part is escaped as needed.
+ */
+jemi_node_t *jemi_concat(jemi_node_t *part, ...);
+
 /**
  * @brief Create a JSON boolean (true or false).
  */
@@ -171,6 +465,19 @@ jemi_node_t *jemi_false(void);
  */
 jemi_node_t *jemi_null(void);
 
+/**
+ * @brief Create a reference to an existing node, which is emitted in place of
+ * the reference.
+ *
+ * Unlike jemi_copy(), this allocates a single node no matter how large the
+ * referenced structure is, and the same node can be referenced any number of
+ * times.  Only the referenced node (and its children) is emitted, not its
+ * siblings.  A reference to NULL is emitted as null.
+ *
+ * NOTE: changes to the referenced node show up everywhere it is referenced.
+ */
+jemi_node_t *jemi_ref(jemi_node_t *node);
+
 // ******************************
 // duplicating a structure
 
@@ -179,6 +486,53 @@ jemi_node_t *jemi_null(void);
  */
 jemi_node_t *jemi_copy(jemi_node_t *root);
 
+/**
+ * @brief Set aside n nodes from the pool for use by jemi_subpool_copy().
+ * Returns false (and sets aside nothing) if fewer than n nodes are available.
+ *
+ * jemi itself is not thread safe, but once each thread has its own subpool,
+ * threads may call jemi_subpool_copy(), jemi_hash() and jemi_equal() on
+ * different parts of the same (unchanging) structure at the same time.  For
+ * example, to snapshot a large array, give each thread a range of elements and
+ * a subpool, then join the copies in order with jemi_array_append().
+ */
+bool jemi_subpool_init(jemi_subpool_t *sub, size_t n);
+
+/**
+ * @brief Like jemi_copy(), but take nodes from the subpool rather than the
+ * pool.  The subpool must hold enough nodes for the entire copy.
+ */
+jemi_node_t *jemi_subpool_copy(jemi_subpool_t *sub, jemi_node_t *root);
+
+/**
+ * @brief Return any nodes remaining in the subpool to the pool.
+ */
+void jemi_subpool_release(jemi_subpool_t *sub);
+
+/**
+ * @brief Return a hash of a node and its contents (but not its siblings).
+ * Structures that are jemi_equal() have the same hash, so comparing hashes is
+ * a cheap way to detect changes between snapshots.
+ */
+uint32_t jemi_hash(jemi_node_t *node);
+
+/**
+ * @brief Return true if two nodes and their contents (but not their siblings)
+ * are identical.  References are followed, and strings are compared by value.
+ */
+bool jemi_equal(jemi_node_t *a, jemi_node_t *b);
+
+/**
+ * @brief Return the number of elements in an array or members (key/value
+ * pairs) in an object without walking its children, or 0 for other nodes.
+ * References are followed.
+ *
+ * NOTE: the count is maintained by jemi's own constructors and modifiers, so
+ * it is only accurate if you don't relink children by hand.  jemi_equal() and
+ * the jemi_persist_xxx() functions walk the children instead.
+ */
+size_t jemi_length(jemi_node_t *node);
+
 // ******************************
 // Composing and modifying JSON elements
 
@@ -205,6 +559,22 @@ jemi_node_t *jemi_object_add_keyval(jemi_node_t *object, const char *key,
  */
 jemi_node_t *jemi_list_append(jemi_node_t *list, jemi_node_t *items);
 
+/**
+ * @brief Apply a JSON Merge Patch (RFC 7396) to target, in place.
+ *
+ * Members of target that also appear in patch are updated in place (keeping
+ * their nodes), members whose patch value is null are removed and returned to
+ * the pool, and new members are appended.  If patch is not an object, target
+ * becomes a copy of patch.  Returns target, or a new structure if target is
+ * NULL.  A NULL patch leaves target as it is.  Returns NULL, without changing
+ * target, if the pool doesn't hold enough nodes to apply all of patch.
+ * References are followed in both: a ref in target is patched where it points.
+ *
+ * NOTE: like jemi_copy(), this doesn't copy strings: target will refer to the
+ * key and value strings of patch.
+ */
+jemi_node_t *jemi_merge_patch(jemi_node_t *target, jemi_node_t *patch);
+
 /**
  * @brief Update contents of a JEMI_FLOAT node
  */
@@ -227,6 +597,413 @@ jemi_node_t *jemi_string_set(jemi_node_t *node, const char *string);
  */
 jemi_node_t *jemi_bool_set(jemi_node_t *node, bool boolean);
 
+// ******************************
+// Streaming output without building a structure
+//
+// The jemi_sw_xxx() functions write JSON directly to a chunked writer without
+// allocating any nodes.  Commas and colons are inserted automatically:
+//
+//     jemi_sw_t sw;
+//     jemi_sw_init(&sw, chunk_fn, arg);
+//     jemi_sw_begin_object(&sw);
+//     jemi_sw_key(&sw, "seq");
+//     jemi_sw_int(&sw, 42);
+//     jemi_sw_key(&sw, "rgb");
+//     jemi_sw_node(&sw, rgb);  // an existing jemi structure
+//     jemi_sw_end(&sw);        // {"seq":42,"rgb":[255,0,255]}
+//
+// Output is flushed each time a top-level value is completed.
+//
+// NOTE: an object or array nested deeper than JEMI_SW_MAX_DEPTH - 1 levels is
+// written as null and everything up to its matching jemi_sw_end() is dropped,
+// so the output stays well-formed.  jemi_sw_truncated() reports when that
+// happened.
+
+/**
+ * @brief Initialize a streaming writer.
+ */
+void jemi_sw_init(jemi_sw_t *sw, jemi_chunk_writer_t chunk_fn, void *arg);
+
+/**
+ * @brief Start a JSON object.  Close it with jemi_sw_end().
+ */
+void jemi_sw_begin_object(jemi_sw_t *sw);
+
+/**
+ * @brief Start a JSON array.  Close it with jemi_sw_end().
+ */
+void jemi_sw_begin_array(jemi_sw_t *sw);
+
+/**
+ * @brief Close the innermost open object or array.
+ */
+void jemi_sw_end(jemi_sw_t *sw);
+
+/**
+ * @brief Write the key of the next key/value pair in an object.
+ */
+void jemi_sw_key(jemi_sw_t *sw, const char *key);
+
+/**
+ * @brief Write a JSON integer.
+ */
+void jemi_sw_int(jemi_sw_t *sw, int64_t value);
+
+/**
+ * @brief Write a JSON float (rendered as by jemi_float()).
+ */
+void jemi_sw_float(jemi_sw_t *sw, double value);
+
+/**
+ * @brief Write a JSON string.
+ */
+void jemi_sw_string(jemi_sw_t *sw, const char *string);
+
+/**
+ * @brief Write a JSON boolean.
+ */
+void jemi_sw_bool(jemi_sw_t *sw, bool boolean);
+
+/**
+ * @brief Write a JSON null.
+ */
+void jemi_sw_null(jemi_sw_t *sw);
+
+/**
+ * @brief Write an existing jemi structure (but not its siblings) as a value.
+ * A NULL node is written as null.
+ */
+void jemi_sw_node(jemi_sw_t *sw, jemi_node_t *node);
+
+/**
+ * @brief Pass any staged output to the chunk writer.
+ */
+void jemi_sw_flush(jemi_sw_t *sw);
+
+/**
+ * @brief Return true if a container nested too deeply was written as null
+ * since jemi_sw_init().
+ */
+bool jemi_sw_truncated(const jemi_sw_t *sw);
+
+// ******************************
+// Transcoding JSON text to CBOR (RFC 8949)
+
+/**
+ * @brief Convert len bytes of JSON text to CBOR, writing it to chunk_fn as it
+ * goes, without allocating any nodes.  Returns false if the text isn't valid
+ * JSON, nests deeper than JEMI_CBOR_MAX_DEPTH or holds a number too large for
+ * a double (such as 1e400).
+ *
+ * Objects and arrays are written as indefinite-length containers, so nothing
+ * has to be buffered.  Integers become CBOR integers (anything outside the
+ * range of a CBOR integer becomes a float), other numbers become single or
+ * double precision floats, whichever is exact.
+ *
+ * NOTE: on error, the CBOR written so far is incomplete: discard it.
+ */
+bool jemi_json_to_cbor(const char *json, size_t len,
+                       jemi_chunk_writer_t chunk_fn, void *arg);
+
+// ******************************
+// Decoding CBOR (RFC 8949) into a structure
+
+/**
+ * @brief Decode len bytes of CBOR into a jemi structure and return its root,
+ * or NULL if the CBOR is malformed, nests deeper than JEMI_CBOR_MAX_DEPTH,
+ * uses types that JSON can't represent or runs out of nodes.
+ *
+ * Text strings are not copied: their nodes (see jemi_string_n()) point into
+ * buf, which must remain valid as long as the structure is in use.  Integers
+ * and floats are decoded directly: unsigned integers above INT64_MAX are kept
+ * as uint64_t (see jemi_node_t), negative integers below INT64_MIN become
+ * floats, and NaN and infinities, which JSON can't express, are rejected.
+ * Tags are ignored and undefined decodes as null.
+ *
+ * NOTE: byte strings and indefinite-length (chunked) text strings are not
+ * supported, nor are map keys that aren't text.  Text containing a quote, a
+ * backslash or a control character is marked with JEMI_STRING_RAW and escaped
+ * when emitted.
+ */
+jemi_node_t *jemi_parse_cbor(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Return the exact number of nodes jemi_parse_cbor() will take from the
+ * pool to decode buf, or 0 if it would fail for any reason other than running
+ * out of nodes.  Nothing is allocated.
+ *
+ * Since strings are referenced in place, no other storage is required: if
+ * jemi_available() is at least the returned count, the parse will succeed.
+ */
+size_t jemi_parse_cbor_requirements(const uint8_t *buf, size_t len);
+
+// ******************************
+// Locating nodes with JSON Pointers (RFC 6901)
+//
+// A resolved node can be kept as a handle and updated repeatedly with the
+// jemi_xxx_set() functions, without re-resolving the path.
+
+/**
+ * @brief Return the node in root designated by a JSON Pointer, e.g.
+ * "/colors/yellow/0", or NULL if there is no such node.
+ *
+ * The empty pointer "" designates root.  Object keys may use the escapes "~0"
+ * (for '~') and "~1" (for '/').
+ */
+jemi_node_t *jemi_pointer_resolve(jemi_node_t *root, const char *pointer);
+
+/**
+ * @brief Resolve several JSON Pointers in a single walk over root.
+ *
+ * On return, handles[i] is the node designated by pointers[i] or NULL if there
+ * is no such node.  Returns the number of pointers that were resolved.
+ */
+size_t jemi_pointer_resolve_many(jemi_node_t *root,
+                                 const char *const *pointers,
+                                 jemi_node_t **handles, size_t n_pointers);
+
+// ******************************
+// Querying with JSONPath
+
+/**
+ * @brief Compile a JSONPath expression into query.
+ *
+ * Supported syntax:
+ *
+ *     $                 the root
+ *     .name ['name']    object member
+ *     [3] [-1]          array element (negative counts from the end)
+ *     .* [*]            every member or element
+ *     ..                recursive descent, e.g. $..name or $..[0]
+ *     [?(@.key)]        elements that have a member named key
+ *     [?(@.key op lit)] elements whose member key compares to a literal
+ *     [?(@ op lit)]     elements that compare to a literal
+ *
+ * where op is one of == != < <= > >= and lit is a number, a 'quoted' or
+ * "quoted" string, true, false or null.
+ *
+ * NOTE: query refers to names and string literals inside path, so path must
+ * remain valid for as long as query is used.
+ *
+ * @return true on success, false if path is malformed or has more than
+ * JEMI_QUERY_MAX_OPS steps.
+ */
+bool jemi_query_compile(jemi_query_t *query, const char *path);
+
+/**
+ * @brief Run a compiled query against root, calling match_fn for each match.
+ *
+ * jemi_query_run() doesn't allocate and uses a fixed stack of
+ * JEMI_QUERY_MAX_DEPTH entries.
+ *
+ * @return the number of matches, or -1 if the stack was exhausted.
+ */
+int jemi_query_run(const jemi_query_t *query, jemi_node_t *root,
+                   jemi_match_fn_t match_fn, void *arg);
+
+// ******************************
+// Validating with JSON Schema
+
+/**
+ * @brief Compile a JSON Schema, given as a jemi structure, into schema.
+ *
+ * Supported keywords:
+ *
+ *     type        a type name or an array of them ("null", "boolean",
+ *                 "object", "array", "number", "string" or "integer")
+ *     enum        an array of allowed values
+ *     minimum     inclusive bounds for numbers
+ *     maximum
+ *     maxLength   maximum length of strings, in code points
+ *     required    an array of member names that objects must have
+ *     properties  an object of member names and the schemas their values
+ *                 must satisfy
+ *     items       the schema that every element of an array must satisfy
+ *
+ * Other keywords are ignored, as are keywords that don't apply to the type of
+ * the value being validated.  The schemas true and false accept and reject
+ * everything.
+ *
+ * NOTE: schema refers to nodes of root (keys and enum values), so root must
+ * remain valid for as long as schema is used.
+ *
+ * @return true on success, false if root is malformed, has more than
+ * JEMI_SCHEMA_MAX_OPS ops or nests deeper than JEMI_SCHEMA_MAX_DEPTH.
+ */
+bool jemi_schema_compile(jemi_schema_t *schema, jemi_node_t *root);
+
+/**
+ * @brief Return true if node satisfies a compiled schema.
+ *
+ * jemi_schema_validate() makes a single pass over node, doesn't allocate and
+ * uses a fixed stack of JEMI_SCHEMA_MAX_DEPTH entries.
+ */
+bool jemi_schema_validate(const jemi_schema_t *schema, jemi_node_t *node);
+
+// ******************************
+// Walking a structure
+//
+// jemi_iter_next() visits a node and its descendants (but not its siblings) in
+// order, without recursion:
+//
+//     jemi_iter_frame_t stack[8];
+//     jemi_iter_t it;
+//     jemi_iter_init(&it, root, stack, 8);
+//     while (jemi_iter_next(&it) != JEMI_ITER_DONE) {
+//         // it.node, it.key and it.level describe the event
+//     }
+//
+// Arrays and objects produce an ENTER event (pre-order) and a LEAVE event
+// (post-order), other nodes a single LEAF event.  Object keys are reported
+// along with their values rather than as events of their own, and references
+// are followed.
+
+/**
+ * @brief Start a walk over root and its descendants, using a caller-supplied
+ * stack of max_depth frames.  Containers nested deeper than max_depth are
+ * entered and left without visiting their children, and it->overflow is set.
+ */
+void jemi_iter_init(jemi_iter_t *it, jemi_node_t *root,
+                    jemi_iter_frame_t *stack, size_t max_depth);
+
+/**
+ * @brief Advance to the next event, and return it.
+ */
+jemi_iter_event_t jemi_iter_next(jemi_iter_t *it);
+
+/**
+ * @brief Called right after a JEMI_ITER_ENTER event, skip the children of the
+ * node: the next event is its JEMI_ITER_LEAVE.
+ */
+void jemi_iter_skip(jemi_iter_t *it);
+
+// ******************************
+// Persistent (versioned) updates
+//
+// The jemi_persist_xxx() functions never modify an existing structure.  Each
+// returns a new root that shares every unchanged subtree with the old root and
+// copies only the nodes on the path from the root to the modified node.  This
+// makes it cheap to keep several versions of a structure for diffing or
+// rollback.
+//
+// NOTE: since subtrees are shared between versions, don't call jemi_xxx_set()
+// or jemi_xxx_append() on a node that is reachable from more than one version.
+// With JEMI_GENERATIONS, shared nodes track changes in the newest version, and
+// the copies on the path are stamped so that jemi_emit_since() reports the
+// update in the new version.
+
+/**
+ * @brief Return a new version of root in which target is replaced by value.
+ *
+ * value must be a single (fresh) node: its sibling field is overwritten.
+ * Returns NULL if target is not found in root or the pool is too low to copy
+ * the path to it, in which case no nodes are taken.
+ */
+jemi_node_t *jemi_persist_set(jemi_node_t *root, jemi_node_t *target,
+                              jemi_node_t *value);
+
+/**
+ * @brief Return a new version of root in which one or more items are appended
+ * to the body of container (a JEMI_ARRAY or JEMI_OBJECT).
+ *
+ * Returns NULL if container is not found in root, isn't an array or object (or
+ * a reference to one) or the pool is too low to copy the path to it and its
+ * children, in which case no nodes are taken.
+ */
+jemi_node_t *jemi_persist_append(jemi_node_t *root, jemi_node_t *container,
+                                 jemi_node_t *items);
+
+/**
+ * @brief Return a new version of root in which target is removed.
+ *
+ * If target is a key or a value in an object, the whole key/value pair is
+ * removed.  Returns NULL if target is not found in root (or if target is root
+ * itself and has no siblings) or the pool is too low to copy the path to it,
+ * in which case no nodes are taken.
+ */
+jemi_node_t *jemi_persist_remove(jemi_node_t *root, jemi_node_t *target);
+
+// ******************************
+// Emitting only what has changed
+//
+// When compiled with JEMI_GENERATIONS defined (for jemi.c and for every file
+// that includes jemi.h), each node records the generation in which it was last
+// created or modified, and each change is propagated to the node's containing
+// arrays and objects.  This adds a parent pointer and a generation number to
+// every node.
+//
+//     uint32_t sent = jemi_generation();
+//     ...
+//     jemi_integer_set(temp, 21);
+//     jemi_emit_since(root, sent, writer_fn, arg); // {"temp":21}
+//     sent = jemi_generation();
+//
+// NOTE: removed members are not reported by jemi_emit_since().
+
+#ifdef JEMI_GENERATIONS
+
+/**
+ * @brief Return the current generation and start a new one.  Subsequent
+ * changes are stamped with a generation greater than the returned value.
+ */
+uint32_t jemi_generation(void);
+
+/**
+ * @brief Output the parts of a JEMI structure that changed after generation.
+ *
+ * Objects are emitted sparsely, containing only the members that changed (so
+ * the output can be applied with jemi_merge_patch()).  Arrays and scalars that
+ * changed are emitted in full.  Unchanged members are skipped without looking
+ * inside them.
+ */
+void jemi_emit_since(jemi_node_t *root, uint32_t generation,
+                     jemi_writer_t writer_fn, void *arg);
+
+#endif
+
+// ******************************
+// Spilling finished structures to storage
+
+/**
+ * @brief Set up storage for jemi_spill().  write_fn appends bytes to the
+ * storage (e.g. a temporary file) and read_fn reads them back as the spilled
+ * structures are emitted.  The storage is considered empty after this call.
+ */
+void jemi_spill_init(jemi_chunk_writer_t write_fn,
+                     jemi_spill_reader_t read_fn, void *arg);
+
+/**
+ * @brief Serialize a finished array or object to the spill storage and return
+ * its children to the pool.  The node stays in place and emits the spilled
+ * bytes from then on.  Returns false (leaving node unchanged) if node isn't an
+ * array or object, or the storage would exceed 4 GiB.
+ *
+ * NOTE: a spilled node can't be modified, searched or appended to, and its
+ * children must not be referenced from elsewhere.
+ */
+bool jemi_spill(jemi_node_t *node);
+
+// ******************************
+// Measuring pool usage
+
+/**
+ * @brief Measure root and its descendants (but not its siblings, nor the
+ * targets of references) into *footprint.
+ */
+void jemi_footprint(jemi_node_t *root, jemi_footprint_t *footprint);
+
+/**
+ * @brief Record the state of every pool node in states, a side table of one
+ * entry per node of the pool given to jemi_init(): free, live (reachable from
+ * one of the n_roots roots, including through references) or leaked.  Returns
+ * the number of leaked nodes.
+ *
+ * NOTE: nodes held by a subpool, or by structures you didn't list in roots,
+ * are reported as leaked.
+ */
+size_t jemi_pool_dump(jemi_node_t *const *roots, size_t n_roots,
+                      jemi_pool_state_t *states);
+
 // ******************************
 // Outputting JSON strings
 
@@ -239,6 +1016,52 @@ jemi_node_t *jemi_bool_set(jemi_node_t *node, bool boolean);
  */
 void jemi_emit(jemi_node_t *root, jemi_writer_t writer_fn, void *arg);
 
+/**
+ * @brief Output a JEMI structure, rendering the nodes named in slots into
+ * fixed-width fields and recording their byte offsets in the output.
+ *
+ * Once the output is in a buffer, jemi_slot_set_int() can update a value by
+ * rewriting just the bytes of its slot, without emitting the structure again.
+ *
+ * NOTE: JSON doesn't allow leading zeros, so use pad = '0' only if the
+ * receiver accepts them.  Leading whitespace (pad = ' ') is always valid.
+ */
+void jemi_emit_slots(jemi_node_t *root, jemi_slot_t *slots, size_t n_slots,
+                     jemi_writer_t writer_fn, void *arg);
+
+/**
+ * @brief Rewrite the slot in buf (the output of jemi_emit_slots()) to hold
+ * value.  Returns false (leaving buf unchanged) if value doesn't fit.
+ */
+bool jemi_slot_set_int(const jemi_slot_t *slot, char *buf, int64_t value);
+
+/**
+ * @brief Output a JEMI structure through a chunked writer.
+ *
+ * Output is staged in JEMI_CHUNK_SIZE byte chunks, so chunk_fn is called far
+ * less often than the writer_fn of jemi_emit().  Unlike jemi_emit(), no null
+ * terminator is written.
+ */
+void jemi_emit_chunked(jemi_node_t *root, jemi_chunk_writer_t chunk_fn,
+                       void *arg);
+
+/**
+ * @brief Output a JEMI structure with one member or element per line, indented
+ * according to style (or two spaces per level if style is NULL).  Key/value
+ * pairs are separated by ": ", and empty arrays and objects render as [] and
+ * {}.
+ */
+void jemi_emit_pretty(jemi_node_t *root, const jemi_pretty_t *style,
+                      jemi_writer_t writer_fn, void *arg);
+
+/**
+ * @brief Like jemi_emit_pretty(), but through a chunked writer (see
+ * jemi_emit_chunked()).  Indentation is written in runs rather than a char at
+ * a time, so this is nearly as fast as compact output.
+ */
+void jemi_emit_pretty_chunked(jemi_node_t *root, const jemi_pretty_t *style,
+                              jemi_chunk_writer_t chunk_fn, void *arg);
+
 /**
  * @brief Return the number of available jemi_node objects.
  *
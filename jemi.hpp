@@ -0,0 +1,315 @@
+/**
+ * @file jemi.hpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 R. Dunbar Poor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @brief Header-only C++17 adapters for jemi: a std::pmr::memory_resource
+ * backed by the jemi pool, and iterators (C++20 views, where available) over
+ * the children of arrays and the members of objects.
+ */
+
+#ifndef _JEMI_HPP_
+#define _JEMI_HPP_
+
+// *****************************************************************************
+// Includes
+
+#include "jemi.h"
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <string_view>
+
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+#include <ranges>
+#endif
+
+namespace jemi {
+
+// *****************************************************************************
+// Public types and definitions
+
+/**
+ * @brief Follow references to the node they refer to.
+ */
+inline jemi_node_t *deref(jemi_node_t *node) noexcept {
+    while (node && node->type == JEMI_REF) {
+        node = node->ref;
+    }
+    return node;
+}
+
+/**
+ * @brief Return the text of a JEMI_STRING node (whether or not it is null
+ * terminated) without copying it.
+ */
+inline std::string_view text(const jemi_node_t &node) noexcept {
+    size_t len = node.length & ~JEMI_STRING_RAW;
+    return std::string_view(node.string, len ? len : std::strlen(node.string));
+}
+
+// ******************************
+// Allocating C++ objects from the jemi pool
+
+/**
+ * @brief A memory resource that hands out jemi pool nodes, so that small C++
+ * objects related to a jemi structure (list and map nodes, handles, ...) share
+ * its fixed-size storage instead of the heap.
+ *
+ * Requests that fit in a jemi_node_t take one node from the pool.  Larger
+ * requests, and all requests once the pool is exhausted, go to upstream (use
+ * std::pmr::null_memory_resource() to get std::bad_alloc instead).  pool and
+ * pool_size must be the arguments given to jemi_init(): they are used only to
+ * tell which memory to return to the pool.
+ *
+ * NOTE: like the pool itself, this is not thread safe.  Memory taken from the
+ * pool is lost to jemi_reset() and jemi_init(), so release it first.
+ */
+class pool_resource : public std::pmr::memory_resource {
+  public:
+    pool_resource(jemi_node_t *pool, size_t pool_size,
+                  std::pmr::memory_resource *upstream =
+                      std::pmr::get_default_resource()) noexcept
+        : m_pool(pool), m_pool_size(pool_size), m_upstream(upstream) {}
+
+    std::pmr::memory_resource *upstream_resource() const noexcept {
+        return m_upstream;
+    }
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        if (bytes <= sizeof(jemi_node_t) && alignment <= alignof(jemi_node_t)) {
+            if (jemi_node_t *node = jemi_null()) {
+                return node;
+            }
+        }
+        return m_upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        if (owns(p)) {
+            // the object overwrote the node: make it safe to free
+            jemi_node_t *node = static_cast<jemi_node_t *>(p);
+            node->type = JEMI_NULL;
+            jemi_free(node);
+        } else {
+            m_upstream->deallocate(p, bytes, alignment);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+
+    bool owns(const void *p) const noexcept {
+        const jemi_node_t *node = static_cast<const jemi_node_t *>(p);
+        return node >= m_pool && node < m_pool + m_pool_size;
+    }
+
+    jemi_node_t *m_pool;
+    size_t m_pool_size;
+    std::pmr::memory_resource *m_upstream;
+};
+
+// ******************************
+// Iterating over arrays and objects
+
+/**
+ * @brief A forward iterator over a list of sibling nodes.  It references the
+ * nodes in place, so it can be used with the standard parallel algorithms.
+ */
+class child_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = jemi_node_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = jemi_node_t *;
+    using reference = jemi_node_t &;
+
+    child_iterator() noexcept = default;
+    explicit child_iterator(jemi_node_t *node) noexcept : m_node(node) {}
+
+    reference operator*() const noexcept { return *m_node; }
+    pointer operator->() const noexcept { return m_node; }
+
+    child_iterator &operator++() noexcept {
+        m_node = m_node->sibling;
+        return *this;
+    }
+    child_iterator operator++(int) noexcept {
+        child_iterator prev = *this;
+        m_node = m_node->sibling;
+        return prev;
+    }
+
+    friend bool operator==(child_iterator a, child_iterator b) noexcept {
+        return a.m_node == b.m_node;
+    }
+    friend bool operator!=(child_iterator a, child_iterator b) noexcept {
+        return a.m_node != b.m_node;
+    }
+
+  private:
+    jemi_node_t *m_node = nullptr;
+};
+
+/**
+ * @brief One key/value pair of an object.
+ */
+struct member {
+    jemi_node_t *key;
+    jemi_node_t *value;
+};
+
+/**
+ * @brief A forward iterator over the key/value pairs of an object.  It yields
+ * member values rather than references, so it is a forward iterator for
+ * std::ranges but only an input iterator for the classic algorithms.
+ */
+class member_iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+#if __cplusplus >= 202002L
+    using iterator_concept = std::forward_iterator_tag;
+#endif
+    using value_type = member;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = member;
+
+    member_iterator() noexcept = default;
+    explicit member_iterator(jemi_node_t *key) noexcept : m_key(key) {}
+
+    member operator*() const noexcept { return member{m_key, m_key->sibling}; }
+
+    member_iterator &operator++() noexcept {
+        m_key = m_key->sibling->sibling;
+        return *this;
+    }
+    member_iterator operator++(int) noexcept {
+        member_iterator prev = *this;
+        ++*this;
+        return prev;
+    }
+
+    friend bool operator==(member_iterator a, member_iterator b) noexcept {
+        return a.m_key == b.m_key;
+    }
+    friend bool operator!=(member_iterator a, member_iterator b) noexcept {
+        return a.m_key != b.m_key;
+    }
+
+  private:
+    jemi_node_t *m_key = nullptr;
+};
+
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+#define JEMI_VIEW_BASE(view) : public std::ranges::view_interface<view>
+#else
+#define JEMI_VIEW_BASE(view)
+#endif
+
+/**
+ * @brief The children of an array (or the keys and values of an object, in
+ * turn), following references.  Empty for other node types.  size() comes from
+ * the cached child count, so no walk is needed.
+ */
+class children_view JEMI_VIEW_BASE(children_view) {
+  public:
+    children_view() noexcept = default;
+    explicit children_view(jemi_node_t *container) noexcept
+        : m_container(deref(container)) {}
+
+    child_iterator begin() const noexcept {
+        return child_iterator(has_children() ? m_container->children
+                                             : nullptr);
+    }
+    child_iterator end() const noexcept { return child_iterator(); }
+    size_t size() const noexcept {
+        return has_children() ? m_container->length : 0;
+    }
+
+  private:
+    bool has_children() const noexcept {
+        return m_container && (m_container->type == JEMI_ARRAY ||
+                               m_container->type == JEMI_OBJECT);
+    }
+
+    jemi_node_t *m_container = nullptr;
+};
+
+/**
+ * @brief The key/value pairs of an object, following references.  Empty for
+ * other node types.
+ */
+class members_view JEMI_VIEW_BASE(members_view) {
+  public:
+    members_view() noexcept = default;
+    explicit members_view(jemi_node_t *object) noexcept
+        : m_object(deref(object)) {}
+
+    member_iterator begin() const noexcept {
+        return member_iterator(is_object() ? m_object->children : nullptr);
+    }
+    member_iterator end() const noexcept { return member_iterator(); }
+    size_t size() const noexcept { return is_object() ? m_object->length / 2 : 0; }
+
+  private:
+    bool is_object() const noexcept {
+        return m_object && m_object->type == JEMI_OBJECT;
+    }
+
+    jemi_node_t *m_object = nullptr;
+};
+
+#undef JEMI_VIEW_BASE
+
+inline children_view children(jemi_node_t *container) noexcept {
+    return children_view(container);
+}
+
+inline members_view members(jemi_node_t *object) noexcept {
+    return members_view(object);
+}
+
+} // namespace jemi
+
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+// the views only refer to nodes, so their iterators outlive them
+namespace std::ranges {
+template <>
+inline constexpr bool enable_borrowed_range<jemi::children_view> = true;
+template <>
+inline constexpr bool enable_borrowed_range<jemi::members_view> = true;
+} // namespace std::ranges
+
+static_assert(std::ranges::forward_range<jemi::children_view>);
+static_assert(std::ranges::sized_range<jemi::children_view>);
+static_assert(std::ranges::forward_range<jemi::members_view>);
+#endif
+
+#endif /* #ifndef _JEMI_HPP_ */
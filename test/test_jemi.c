@@ -30,15 +30,21 @@ To run the tests (on a POSIX / gcc style environment):
 
 gcc -g -Wall -I.. -o test_jemi test_jemi.c ../jemi.c && ./test_jemi && rm -rf ./test_jemi ./test_jemi.dSYM
 
+To also test the features enabled by JEMI_GENERATIONS:
+
+gcc -g -Wall -DJEMI_GENERATIONS -I.. -o test_jemi test_jemi.c ../jemi.c && ./test_jemi && rm -rf ./test_jemi ./test_jemi.dSYM
+
 */
 
 // *****************************************************************************
 // Includes
 
 #include "jemi.h"
+#include <float.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // *****************************************************************************
@@ -56,6 +62,11 @@ typedef struct {
 } json_writer_ctx;
 
 
+typedef struct {
+    jemi_node_t *matches[8];
+    size_t n_matches;
+} query_results_t;
+
 // *****************************************************************************
 // Private (static) storage
 
@@ -76,11 +87,35 @@ static void assert(bool expr, const char *str, const char *file, int line);
  */
 static void writer_fn(char c, void *ctx);
 
+/**
+ * @brief Append a chunk of chars to s_json_string[] and null terminate.
+ */
+static void chunk_writer_fn(const char *buf, size_t len, void *ctx);
+
+/**
+ * @brief Read back spilled chars from a json_writer_ctx: long reads point into
+ * its buffer, short reads are copied.
+ */
+static size_t spill_reader_fn(size_t offset, size_t len, char *buf,
+                              const char **data, void *arg);
+
 /**
  * @brief Render JSON and compare against expected
  */
 static bool renders_as(jemi_node_t *node, const char *expected);
 
+#ifdef JEMI_GENERATIONS
+/**
+ * @brief Render changes since generation and compare against expected
+ */
+static bool renders_as_since(jemi_node_t *node, uint32_t generation, const char *expected);
+#endif
+
+/**
+ * @brief Run a JSONPath query and compare the matches against expected.
+ */
+static bool queries_as(jemi_node_t *root, const char *path, const char *expected);
+
 // *****************************************************************************
 // Public code
 
@@ -136,10 +171,38 @@ int main(void) {
     root = jemi_integer(INT64_MIN);  // most negative
     ASSERT(renders_as(root, "-9223372036854775808"));
 
+    jemi_reset();
+    root = jemi_float(9223372036854775808.0);  // just past INT64_MAX
+    ASSERT(renders_as(root, "9223372036854775808.000000"));
+
+    // the longest float text isn't truncated
+    jemi_reset();
+    do {
+        char text[400];
+        json_writer_ctx ctx = {.buf = text, .buflen = sizeof(text), .index = 0};
+        jemi_emit(jemi_float(-DBL_MAX), writer_fn, &ctx);
+        ASSERT(ctx.index == 318); // 317 chars and a null
+        ASSERT(strncmp(text, "-1797693134862315708", 20) == 0);
+        ASSERT(strcmp(&text[310], ".000000") == 0);
+        // even in a slot, which can't be widened that far
+        jemi_slot_t slot = {.node = jemi_float(DBL_MAX), .width = 4, .pad = '0'};
+        ctx.index = 0;
+        jemi_emit_slots(slot.node, &slot, 1, writer_fn, &ctx);
+        ASSERT(ctx.index == 317 && slot.offset == 0);
+        ASSERT(slot.width == 0); // so jemi_slot_set_int() won't touch it
+        ASSERT(jemi_slot_set_int(&slot, text, 1) == false);
+    } while(false);
+
     jemi_reset();
     root = jemi_string("red");
     ASSERT(renders_as(root, "\"red\""));
 
+    jemi_reset();
+    root = jemi_string_n("redder", 3);
+    ASSERT(renders_as(root, "\"red\""));
+    ASSERT(jemi_string_n("red", JEMI_STRING_MAX_LENGTH) == NULL); // too long
+    ASSERT(jemi_available() == JEMI_POOL_SIZE - 1);
+
     jemi_reset();
     root = jemi_bool(true);
     ASSERT(renders_as(root, "true"));
@@ -306,6 +369,1063 @@ int main(void) {
                                      "}}"));
     } while(false);
 
+    // jemi_pointer_resolve() locates nodes by JSON Pointer
+    jemi_reset();
+    do {
+        jemi_node_t *handles[6];
+        const char *pointers[6] = {"/colors/cyan/2", "/colors/a~1b", "",
+                                   "/colors/yellow/3", "/colors/cyan/0", "/x/y"};
+        jemi_node_t *many_handles[100];
+        const char *many_pointers[100];
+
+        root = jemi_object(
+            jemi_string("colors"),
+            jemi_object(
+                jemi_string("yellow"),
+                jemi_array(jemi_integer(255), jemi_integer(255), jemi_integer(0), NULL),
+                jemi_string("cyan"),
+                jemi_array(jemi_integer(0), jemi_integer(255), jemi_integer(255), NULL),
+                jemi_string("a/b"),
+                jemi_true(),
+                NULL),
+            NULL);
+        ASSERT(jemi_pointer_resolve(root, "") == root);
+        ASSERT(jemi_pointer_resolve(root, "/colors/yellow")->type == JEMI_ARRAY);
+        ASSERT(jemi_pointer_resolve(root, "/colors/cyan/1")->integer == 255);
+        ASSERT(renders_as(jemi_pointer_resolve(root, "/colors/a~1b"), "true"));
+        ASSERT(jemi_pointer_resolve(root, "/colors/yellow/3") == NULL);
+        ASSERT(jemi_pointer_resolve(root, "/colors/yellow/01") == NULL);
+        ASSERT(jemi_pointer_resolve(root, "/colors/yellow/0/0") == NULL);
+        ASSERT(jemi_pointer_resolve(root, "colors") == NULL);
+
+        // resolved nodes serve as handles for the jemi_xxx_set() functions
+        jemi_integer_set(jemi_pointer_resolve(root, "/colors/yellow/2"), 128);
+        ASSERT(renders_as(root, "{\"colors\":{"
+                                "\"yellow\":[255,255,128],"
+                                "\"cyan\":[0,255,255],"
+                                "\"a/b\":true"
+                                "}}"));
+
+        ASSERT(jemi_pointer_resolve_many(root, pointers, handles, 6) == 4);
+        ASSERT(handles[0] == jemi_pointer_resolve(root, pointers[0]));
+        ASSERT(renders_as(handles[1], "true"));
+        ASSERT(handles[2] == root);
+        ASSERT(handles[3] == NULL);
+        ASSERT(handles[4]->integer == 0);
+        ASSERT(handles[5] == NULL);
+
+        // more pointers than fit in a single walk
+        for (int i = 0; i < 100; i++) {
+            many_pointers[i] = pointers[i % 6];
+        }
+        ASSERT(jemi_pointer_resolve_many(root, many_pointers, many_handles,
+                                         100) == 67);
+        for (int i = 0; i < 100; i++) {
+            ASSERT(many_handles[i] == handles[i % 6]);
+        }
+    } while(false);
+
+    // jemi_query_compile() and jemi_query_run() evaluate JSONPath queries
+    jemi_reset();
+    do {
+        jemi_query_t query;
+
+        root = jemi_object(
+            jemi_string("sensors"),
+            jemi_array(
+                jemi_object(jemi_string("id"), jemi_string("a"),
+                            jemi_string("temp"), jemi_integer(20), NULL),
+                jemi_object(jemi_string("id"), jemi_string("b"),
+                            jemi_string("temp"), jemi_float(31.5),
+                            jemi_string("alarm"), jemi_true(), NULL),
+                jemi_object(jemi_string("id"), jemi_string("c"),
+                            jemi_string("temp"), jemi_integer(25), NULL),
+                NULL),
+            NULL);
+        ASSERT(queries_as(root, "$.sensors[0].id", "[\"a\"]"));
+        ASSERT(queries_as(root, "$['sensors'][-1].temp", "[25]"));
+        ASSERT(queries_as(root, "$.sensors[*].id", "[\"a\",\"b\",\"c\"]"));
+        ASSERT(queries_as(root, "$..temp", "[20,31.500000,25]"));
+        ASSERT(queries_as(root, "$.sensors[?(@.temp > 21)].id", "[\"b\",\"c\"]"));
+        ASSERT(queries_as(root, "$.sensors[?(@.id == 'c')].temp", "[25]"));
+        ASSERT(queries_as(root, "$.sensors[?(@.alarm)].id", "[\"b\"]"));
+        ASSERT(queries_as(root, "$.sensors[*].temp[?(@ <= 25)]", "[]"));
+        ASSERT(queries_as(root, "$.sensors[3]", "[]"));
+        ASSERT(!jemi_query_compile(&query, "sensors"));
+        ASSERT(!jemi_query_compile(&query, "$.sensors[?(@.id ~ 1)]"));
+        ASSERT(!jemi_query_compile(&query, "$.sensors[0"));
+    } while(false);
+
+    // jemi_free() returns a node and its children to the pool
+    jemi_reset();
+    root = jemi_array(jemi_integer(1), jemi_array(jemi_null(), NULL), NULL);
+    ASSERT(jemi_available() == JEMI_POOL_SIZE - 4);
+    jemi_free(root);
+    ASSERT(jemi_available() == JEMI_POOL_SIZE);
+
+    // jemi_merge_patch() updates a structure in place (RFC 7396)
+    jemi_reset();
+    do {
+        jemi_node_t *target, *patch, *temp;
+        jemi_pool_state_t states[JEMI_POOL_SIZE];
+        size_t available;
+
+        target = jemi_object(jemi_string("name"), jemi_string("dev"),
+                             jemi_string("temp"), temp = jemi_integer(20),
+                             jemi_string("tags"), jemi_array(jemi_string("a"), jemi_string("b"), NULL),
+                             jemi_string("net"), jemi_object(jemi_string("ip"), jemi_string("10.0.0.1"),
+                                                             jemi_string("dhcp"), jemi_true(),
+                                                             NULL),
+                             NULL);
+        patch = jemi_object(jemi_string("temp"), jemi_integer(21),
+                            jemi_string("tags"), jemi_null(),
+                            jemi_string("net"), jemi_object(jemi_string("dhcp"), jemi_null(),
+                                                            jemi_string("mask"), jemi_integer(24),
+                                                            NULL),
+                            jemi_string("mode"), jemi_object(jemi_string("x"), jemi_null(), NULL),
+                            NULL);
+        available = jemi_available();
+        ASSERT(jemi_merge_patch(target, patch) == target);
+        ASSERT(renders_as(target, "{\"name\":\"dev\",\"temp\":21,"
+                                  "\"net\":{\"ip\":\"10.0.0.1\",\"mask\":24},"
+                                  "\"mode\":{}}"));
+        // existing node updated in place
+        ASSERT(temp->integer == 21);
+        // removed: tags (4 nodes) and dhcp (2 nodes), added: mask and mode (4 nodes)
+        ASSERT(jemi_available() == available + 6 - 4);
+
+        // a non-object patch replaces the target
+        target = jemi_object(jemi_string("a"), jemi_true(), NULL);
+        ASSERT(jemi_merge_patch(target, jemi_array(jemi_integer(1), NULL)) == target);
+        ASSERT(renders_as(target, "[1]"));
+
+        // a composed string replaces (and frees) the target's parts
+        jemi_reset();
+        target = jemi_object(jemi_string("id"),
+                             jemi_concat(jemi_string("a-"), jemi_integer(1), NULL),
+                             NULL);
+        patch = jemi_object(jemi_string("id"),
+                            jemi_concat(jemi_string("b-"), jemi_integer(2), NULL),
+                            NULL);
+        available = jemi_available();
+        jemi_merge_patch(target, patch);
+        ASSERT(jemi_available() == available);
+        ASSERT(jemi_pool_dump((jemi_node_t *[]){target, patch}, 2, states) == 0);
+        jemi_free(patch);
+        ASSERT(jemi_available() == available + 5);
+        ASSERT(renders_as(jemi_array(jemi_integer(7), jemi_integer(8), jemi_integer(9), NULL),
+                          "[7,8,9]"));
+        ASSERT(renders_as(target, "{\"id\":\"b-2\"}"));
+
+        // a NULL patch changes nothing
+        ASSERT(jemi_merge_patch(target, NULL) == target);
+        ASSERT(jemi_merge_patch(NULL, NULL) == NULL);
+        ASSERT(renders_as(target, "{\"id\":\"b-2\"}"));
+
+        // a patch the pool can't hold is refused before target is touched
+        patch = jemi_object(jemi_string("id"), jemi_null(),
+                            jemi_string("tags"), jemi_array(jemi_integer(1), jemi_integer(2), NULL),
+                            NULL);
+        while (jemi_available() > 3) {
+            jemi_null(); // the new member needs 4 nodes
+        }
+        ASSERT(jemi_merge_patch(target, patch) == NULL);
+        ASSERT(jemi_available() == 3);
+        ASSERT(renders_as(target, "{\"id\":\"b-2\"}"));
+        jemi_null();
+        ASSERT(jemi_merge_patch(NULL, patch) == NULL); // 5 nodes, with the object
+        ASSERT(jemi_available() == 2);
+
+        // refs are followed in patch and in target, so no nulls leak through
+        jemi_reset();
+        temp = jemi_object(jemi_string("x"), jemi_integer(1), NULL);
+        target = jemi_object(jemi_string("a"), jemi_integer(1),
+                             jemi_string("n"), jemi_ref(temp),
+                             NULL);
+        patch = jemi_object(jemi_string("b"), jemi_ref(jemi_object(jemi_string("q"), jemi_null(),
+                                                                   jemi_string("r"), jemi_integer(1),
+                                                                   NULL)),
+                            jemi_string("n"), jemi_ref(jemi_object(jemi_string("y"), jemi_integer(2), NULL)),
+                            jemi_string("a"), jemi_ref(NULL),
+                            NULL);
+        ASSERT(jemi_merge_patch(target, patch) == target);
+        ASSERT(renders_as(target, "{\"n\":{\"x\":1,\"y\":2},\"b\":{\"r\":1}}"));
+        ASSERT(renders_as(temp, "{\"x\":1,\"y\":2}"));
+        ASSERT(jemi_merge_patch(target, jemi_ref(NULL)) == target);
+    } while(false);
+
+    // jemi_emit_slots() renders selected numbers into fixed-width slots...
+    jemi_reset();
+    do {
+        jemi_node_t *seq, *temp;
+        jemi_slot_t slots[2];
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+
+        root = jemi_object(jemi_string("seq"), seq = jemi_integer(7),
+                           jemi_string("temp"), temp = jemi_integer(-3),
+                           NULL);
+        slots[0] = (jemi_slot_t){.node = seq, .width = 6, .pad = ' '};
+        slots[1] = (jemi_slot_t){.node = temp, .width = 4, .pad = '0'};
+        jemi_emit_slots(root, slots, 2, writer_fn, &ctx);
+        ASSERT(strcmp(s_json_string, "{\"seq\":     7,\"temp\":-003}") == 0);
+        ASSERT(slots[0].offset == 7);
+        ASSERT(slots[1].offset == 21);
+
+        // ... which jemi_slot_set_int() can update in place
+        ASSERT(jemi_slot_set_int(&slots[0], s_json_string, 123456));
+        ASSERT(jemi_slot_set_int(&slots[1], s_json_string, 42));
+        ASSERT(strcmp(s_json_string, "{\"seq\":123456,\"temp\":0042}") == 0);
+        ASSERT(!jemi_slot_set_int(&slots[0], s_json_string, -123456));
+        ASSERT(strcmp(s_json_string, "{\"seq\":123456,\"temp\":0042}") == 0);
+    } while(false);
+
+    // jemi_emit_chunked() writes the same JSON in chunks
+    jemi_reset();
+    do {
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+        root = jemi_object(jemi_string("a string longer than a single chunk of output"),
+                           jemi_array(jemi_integer(1), jemi_float(2.5), jemi_null(), NULL),
+                           NULL);
+        jemi_emit_chunked(root, chunk_writer_fn, &ctx);
+        ASSERT(strcmp(s_json_string, "{\"a string longer than a single chunk of output\":"
+                                     "[1,2.500000,null]}") == 0);
+    } while(false);
+
+    // jemi_sw_xxx() stream JSON without building a structure
+    jemi_reset();
+    do {
+        jemi_sw_t sw;
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+        size_t available;
+
+        root = jemi_array(jemi_integer(255), jemi_integer(0), jemi_integer(255), NULL);
+        available = jemi_available();
+        jemi_sw_init(&sw, chunk_writer_fn, &ctx);
+        jemi_sw_begin_object(&sw);
+        jemi_sw_key(&sw, "seq");
+        jemi_sw_int(&sw, 42);
+        ASSERT(ctx.index == 0); // output is staged until the top-level value is done
+        jemi_sw_key(&sw, "ok");
+        jemi_sw_bool(&sw, true);
+        jemi_sw_key(&sw, "list");
+        jemi_sw_begin_array(&sw);
+        jemi_sw_float(&sw, 1.5);
+        jemi_sw_string(&sw, "x");
+        jemi_sw_null(&sw);
+        jemi_sw_begin_object(&sw);
+        jemi_sw_end(&sw);
+        jemi_sw_end(&sw);
+        jemi_sw_key(&sw, "rgb");
+        jemi_sw_node(&sw, root);
+        jemi_sw_key(&sw, "none");
+        jemi_sw_node(&sw, NULL);
+        jemi_sw_end(&sw);
+        ASSERT(strcmp(s_json_string, "{\"seq\":42,\"ok\":true,"
+                                     "\"list\":[1.500000,\"x\",null,{}],"
+                                     "\"rgb\":[255,0,255],\"none\":null}") == 0);
+        ASSERT(jemi_available() == available);
+        ASSERT(!jemi_sw_truncated(&sw));
+
+        // containers nested too deeply are written as null
+        ctx.index = 0;
+        jemi_sw_init(&sw, chunk_writer_fn, &ctx);
+        for (int i = 0; i < JEMI_SW_MAX_DEPTH + 2; i++) {
+            jemi_sw_begin_array(&sw);
+        }
+        jemi_sw_int(&sw, 1);
+        jemi_sw_begin_object(&sw);
+        jemi_sw_key(&sw, "a");
+        jemi_sw_end(&sw);
+        for (int i = 0; i < JEMI_SW_MAX_DEPTH + 1; i++) {
+            jemi_sw_end(&sw);
+        }
+        jemi_sw_int(&sw, 2);
+        jemi_sw_end(&sw);
+        ASSERT(jemi_sw_truncated(&sw));
+        ASSERT(strcmp(s_json_string, "[[[[[[[[[[[[[[[null]]]]]]]]]]]]]],2]") == 0);
+    } while(false);
+
+#ifdef JEMI_GENERATIONS
+    // jemi_emit_since() emits only what changed after a given generation
+    jemi_reset();
+    do {
+        jemi_node_t *temp, *rgb, *blue, *late;
+        uint32_t sent;
+
+        root = jemi_object(jemi_string("name"), jemi_string("dev"),
+                           jemi_string("temp"), temp = jemi_integer(20),
+                           jemi_string("led"), jemi_object(
+                               jemi_string("on"), jemi_true(),
+                               jemi_string("rgb"), rgb = jemi_array(jemi_integer(255),
+                                                                    jemi_integer(0),
+                                                                    blue = jemi_integer(255),
+                                                                    NULL),
+                               NULL),
+                           NULL);
+        sent = jemi_generation();
+        ASSERT(renders_as_since(root, sent, "{}"));
+
+        jemi_integer_set(temp, 21);
+        ASSERT(renders_as_since(root, sent, "{\"temp\":21}"));
+        jemi_integer_set(blue, 128);
+        ASSERT(renders_as_since(root, sent, "{\"temp\":21,\"led\":{\"rgb\":[255,0,128]}}"));
+
+        sent = jemi_generation();
+        ASSERT(renders_as_since(root, sent, "{}"));
+        jemi_object_add_keyval(root, "seq", jemi_integer(1));
+        jemi_array_append(rgb, jemi_integer(9));
+        ASSERT(renders_as_since(root, sent, "{\"led\":{\"rgb\":[255,0,128,9]},\"seq\":1}"));
+
+        // a member built before sent but attached after it is reported
+        late = jemi_list(jemi_string("mode"), jemi_string("auto"), NULL);
+        sent = jemi_generation();
+        jemi_object_append(root, late);
+        ASSERT(renders_as_since(root, sent, "{\"mode\":\"auto\"}"));
+
+        // changes made to a copy are tracked in the copy
+        sent = jemi_generation();
+        root = jemi_copy(root);
+        sent = jemi_generation();
+        jemi_bool_set(jemi_pointer_resolve(root, "/led/on"), false);
+        ASSERT(renders_as_since(root, sent, "{\"led\":{\"on\":false}}"));
+    } while(false);
+#endif
+
+    // jemi_ref() emits a shared structure in place
+    jemi_reset();
+    do {
+        jemi_node_t *header, *blue;
+        size_t available;
+
+        header = jemi_object(jemi_string("v"), jemi_integer(2),
+                             jemi_string("rgb"), jemi_array(jemi_integer(0),
+                                                            jemi_integer(0),
+                                                            blue = jemi_integer(255),
+                                                            NULL),
+                             NULL);
+        available = jemi_available();
+        root = jemi_array(jemi_ref(header), jemi_ref(header), jemi_ref(jemi_ref(blue)), NULL);
+        ASSERT(jemi_available() == available - 5);
+        ASSERT(renders_as(root, "[{\"v\":2,\"rgb\":[0,0,255]},"
+                                "{\"v\":2,\"rgb\":[0,0,255]},"
+                                "255]"));
+        // JSON Pointers and queries look through references
+        ASSERT(jemi_pointer_resolve(root, "/1/rgb/2") == blue);
+        ASSERT(queries_as(root, "$[?(@.v == 2)].rgb[2]", "[255,255]"));
+        // a copy shares the referenced structure
+        ASSERT(renders_as(jemi_copy(root), "[{\"v\":2,\"rgb\":[0,0,255]},"
+                                           "{\"v\":2,\"rgb\":[0,0,255]},"
+                                           "255]"));
+        // a reference to nothing is null
+        root = jemi_array(jemi_integer(1), jemi_ref(NULL), jemi_integer(2), NULL);
+        ASSERT(renders_as(root, "[1,null,2]"));
+        ASSERT(jemi_pointer_resolve(root, "/1/0") == NULL);
+        ASSERT(queries_as(root, "$[?(@.v == 2)]", "[]"));
+    } while(false);
+
+    // jemi_array_from_xxx() build arrays from C arrays in one allocation
+    jemi_reset();
+    do {
+        const int64_t ints[] = {1, -2, 3};
+        const double floats[] = {0.5, 2};
+        const char *const strings[] = {"a", "b"};
+        jemi_node_t *ints_node;
+
+        ASSERT(renders_as(ints_node = jemi_array_from_ints(ints, 3), "[1,-2,3]"));
+        ASSERT(jemi_available() == JEMI_POOL_SIZE - 4);
+        ASSERT(renders_as(jemi_array_from_floats(floats, 2), "[0.500000,2]"));
+        ASSERT(renders_as(jemi_array_from_strings(strings, 2), "[\"a\",\"b\"]"));
+        ASSERT(renders_as(jemi_array_from_ints(ints, 0), "[]"));
+        // all or nothing: a request larger than the pool takes no nodes
+        size_t available = jemi_available();
+        ASSERT(jemi_array_from_ints(ints, available) == NULL);
+        ASSERT(jemi_available() == available);
+        ASSERT(jemi_array_from_ints(ints, 3) != NULL);
+        jemi_array_append(ints_node, jemi_integer(4));
+        ASSERT(renders_as(ints_node, "[1,-2,3,4]"));
+    } while(false);
+
+    // jemi_object_from_xxx() build objects from key/value tables
+    jemi_reset();
+    do {
+        const char *const keys[] = {"id", "temp", "ok"};
+        const int64_t ints[] = {7, 21, 1};
+        const bool bools[] = {true, false, true};
+        jemi_node_t *values[3];
+        jemi_node_t *many[JEMI_POOL_SIZE];
+
+        values[0] = jemi_string("dev");
+        values[1] = jemi_float(21.5);
+        values[2] = jemi_array(jemi_null(), NULL);
+        root = jemi_object_from_table(keys, values, 3);
+        ASSERT(renders_as(root, "{\"id\":\"dev\",\"temp\":21.500000,\"ok\":[null]}"));
+        ASSERT(jemi_pointer_resolve(root, "/temp") == values[1]);
+        jemi_object_add_keyval(root, "seq", jemi_integer(1));
+        ASSERT(renders_as(root, "{\"id\":\"dev\",\"temp\":21.500000,\"ok\":[null],\"seq\":1}"));
+
+        ASSERT(renders_as(jemi_object_from_column(keys, JEMI_INTEGER, ints, 3),
+                          "{\"id\":7,\"temp\":21,\"ok\":1}"));
+        ASSERT(renders_as(jemi_object_from_column(keys, JEMI_TRUE, bools, 3),
+                          "{\"id\":true,\"temp\":false,\"ok\":true}"));
+        ASSERT(renders_as(jemi_object_from_column(keys, JEMI_INTEGER, ints, 0), "{}"));
+        // all or nothing
+        size_t available = jemi_available();
+        for (size_t i = 0; i < available; i++) {
+            many[i] = values[0];
+        }
+        ASSERT(jemi_object_from_table(keys, many, available) == NULL);
+        ASSERT(jemi_available() == available);
+        // a NULL value (or a type that isn't a column type) takes nothing
+        jemi_node_t *next = values[0]->sibling;
+        values[1] = NULL;
+        ASSERT(jemi_object_from_table(keys, values, 3) == NULL);
+        ASSERT(values[0]->sibling == next);
+        ASSERT(jemi_object_from_column(keys, JEMI_NULL, ints, 3) == NULL);
+        ASSERT(jemi_object_from_column(keys, JEMI_ARRAY, ints, 3) == NULL);
+        ASSERT(jemi_available() == available);
+    } while(false);
+
+    // runs of integers are formatted in batches
+    jemi_reset();
+    do {
+        const int64_t ints[] = {0, 9, 10, 99, 100, -1, -10, -100, 123456789012345,
+                                INT64_MAX, INT64_MIN, 7, 42};
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+        const char *expected = "[0,9,10,99,100,-1,-10,-100,123456789012345,"
+                               "9223372036854775807,-9223372036854775808,7,42,"
+                               "\"x\",1,2]";
+
+        root = jemi_array_from_ints(ints, 13);
+        jemi_array_append(root, jemi_list(jemi_string("x"), jemi_integer(1), jemi_integer(2), NULL));
+        ASSERT(renders_as(root, expected));
+        jemi_emit_chunked(root, chunk_writer_fn, &ctx);
+        ASSERT(strcmp(s_json_string, expected) == 0);
+    } while(false);
+
+    // jemi_concat() composes strings from parts
+    jemi_reset();
+    do {
+        jemi_node_t *id = jemi_integer(12);
+        root = jemi_concat(jemi_string("sensor-"), id, jemi_string("/"),
+                           jemi_concat(jemi_string("ch"), jemi_integer(-3), NULL),
+                           NULL);
+        ASSERT(renders_as(root, "\"sensor-12/ch-3\""));
+        jemi_integer_set(id, 345);
+        ASSERT(renders_as(root, "\"sensor-345/ch-3\""));
+        ASSERT(renders_as(jemi_concat(NULL), "\"\""));
+        // parts are escaped
+        root = jemi_concat(jemi_string("say \"hi\"\\\n\t\x01"), jemi_ref(id), NULL);
+        ASSERT(renders_as(root, "\"say \\\"hi\\\"\\\\\\n\\t\\u0001345\""));
+        // copies and frees include the parts
+        size_t available = jemi_available();
+        jemi_node_t *copy = jemi_copy(root);
+        ASSERT(jemi_available() == available - 3);
+        ASSERT(renders_as(copy, "\"say \\\"hi\\\"\\\\\\n\\t\\u0001345\""));
+        jemi_free(copy);
+        ASSERT(jemi_available() == available);
+    } while(false);
+
+    // subpools, jemi_hash() and jemi_equal()
+    jemi_reset();
+    do {
+        jemi_subpool_t sub1, sub2, sub3;
+        jemi_node_t *copy1, *copy2;
+        jemi_node_t *temp = jemi_integer(20);
+        root = jemi_array(jemi_object(jemi_string("temp"), temp, NULL),
+                          jemi_concat(jemi_string("id-"), jemi_integer(3), NULL),
+                          jemi_float(1.5), jemi_null(), NULL);
+        size_t available = jemi_available();
+        ASSERT(jemi_subpool_init(&sub1, 8));
+        ASSERT(jemi_subpool_init(&sub2, 9));
+        ASSERT(jemi_subpool_init(&sub3, available) == false);
+        ASSERT(jemi_available() == available - 17);
+        // like jemi_copy(), copies include siblings
+        copy1 = jemi_subpool_copy(&sub1, root->children);
+        copy2 = jemi_subpool_copy(&sub2, root->children->sibling);
+        ASSERT(sub1.freelist == NULL);        // used all 8 nodes
+        ASSERT(jemi_available() == available - 17);
+        jemi_subpool_release(&sub2);          // returns 9 - 5 unused nodes
+        ASSERT(jemi_available() == available - 13);
+        ASSERT(renders_as(jemi_array_append(jemi_array(NULL), copy1),
+                          "[{\"temp\":20},\"id-3\",1.500000,null]"));
+        ASSERT(jemi_equal(root->children, copy1));
+        ASSERT(jemi_hash(root->children) == jemi_hash(copy1));
+        ASSERT(jemi_equal(copy2, jemi_ref(root->children->sibling)));
+        ASSERT(jemi_equal(copy1, copy2) == false);
+        ASSERT(jemi_hash(copy1) != jemi_hash(copy2));
+        jemi_integer_set(temp, 21);
+        ASSERT(jemi_equal(root->children, copy1) == false);
+        ASSERT(jemi_hash(root->children) != jemi_hash(copy1));
+        ASSERT(jemi_equal(jemi_array(NULL), jemi_array(jemi_null(), NULL)) == false);
+        ASSERT(jemi_hash(jemi_array(jemi_array(NULL), NULL)) !=
+               jemi_hash(jemi_array(jemi_array(NULL), jemi_array(NULL), NULL)));
+        ASSERT(jemi_equal(jemi_float(0.0), jemi_float(-0.0)));
+        ASSERT(jemi_hash(jemi_float(0.0)) == jemi_hash(jemi_float(-0.0)));
+    } while(false);
+
+    // jemi_spill() moves finished structures out of the pool
+    jemi_reset();
+    do {
+        char spill_buf[2 * MAX_JSON_LENGTH];
+        json_writer_ctx spill = {.buf=spill_buf,
+                                 .buflen=sizeof(spill_buf),
+                                 .index = 0};
+        jemi_node_t *big = jemi_array(NULL);
+        const char *expected = "[{\"id\":1,\"tags\":[\"a\",\"b\"]},"
+                               "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,"
+                               "20,21,22,23,24,25,26,27,28,29],\"tail\"]";
+
+        ASSERT(jemi_spill(big) == false); // no storage yet
+        jemi_spill_init(chunk_writer_fn, spill_reader_fn, &spill);
+        jemi_node_t *small = jemi_object(jemi_string("id"), jemi_integer(1),
+                                         jemi_string("tags"),
+                                         jemi_array(jemi_string("a"), jemi_string("b"), NULL),
+                                         NULL);
+        for (int i = 0; i < 30; i++) {
+            jemi_array_append(big, jemi_integer(i));
+        }
+        root = jemi_array(small, big, jemi_string("tail"), NULL);
+        ASSERT(renders_as(root, expected));
+        size_t available = jemi_available();
+        ASSERT(jemi_spill(small));
+        ASSERT(jemi_available() == available + 6);
+        ASSERT(jemi_spill(big));
+        ASSERT(jemi_available() == available + 36);
+        ASSERT(jemi_spill(root->children->sibling->sibling) == false);
+        ASSERT(spill.index == strlen(expected) - strlen("[,,\"tail\"]"));
+        ASSERT(renders_as(root, expected));
+        jemi_emit_chunked(root, chunk_writer_fn, &(json_writer_ctx){
+            .buf=s_json_string, .buflen=sizeof(s_json_string), .index = 0});
+        ASSERT(strcmp(s_json_string, expected) == 0);
+        // spilled structures can be copied and spilled again
+        jemi_node_t *copy = jemi_copy(root);
+        ASSERT(jemi_equal(root, copy));
+        ASSERT(jemi_spill(copy));
+        ASSERT(renders_as(copy, expected));
+    } while(false);
+
+    // jemi_json_to_cbor() transcodes without allocating nodes
+    jemi_reset();
+    do {
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+        const char *json = "{\"a\": [1, -2, 1.5, true, null], \"b\": \"x\\u00e9\\n\"}";
+        const uint8_t cbor[] = {0xbf, 0x61, 'a', 0x9f, 0x01, 0x21, 0xfa, 0x3f,
+                                0xc0, 0x00, 0x00, 0xf5, 0xf6, 0xff, 0x61, 'b',
+                                0x64, 'x', 0xc3, 0xa9, '\n', 0xff};
+        size_t available = jemi_available();
+        ASSERT(jemi_json_to_cbor(json, strlen(json), chunk_writer_fn, &ctx));
+        ASSERT(ctx.index == sizeof(cbor) && memcmp(s_json_string, cbor, sizeof(cbor)) == 0);
+        ASSERT(jemi_available() == available);
+
+        json = "[24,256,65536,4294967296,18446744073709551615,"
+               "-18446744073709551616,0.1,\"\\ud83d\\ude00\",[],{}]";
+        const uint8_t cbor2[] = {0x9f, 0x18, 24, 0x19, 0x01, 0x00,
+                                 0x1a, 0x00, 0x01, 0x00, 0x00,
+                                 0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+                                 0x1b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                 0xfa, 0xdf, 0x80, 0x00, 0x00,
+                                 0xfb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a,
+                                 0x64, 0xf0, 0x9f, 0x98, 0x80,
+                                 0x9f, 0xff, 0xbf, 0xff, 0xff};
+        ctx.index = 0;
+        ASSERT(jemi_json_to_cbor(json, strlen(json), chunk_writer_fn, &ctx));
+        ASSERT(ctx.index == sizeof(cbor2) && memcmp(s_json_string, cbor2, sizeof(cbor2)) == 0);
+
+        ctx.index = 0;
+        ASSERT(jemi_json_to_cbor(" 42 ", 4, chunk_writer_fn, &ctx));
+        ASSERT(ctx.index == 2 && memcmp(s_json_string, "\x18\x2a", 2) == 0);
+
+        // numbers of any length, in a container or at the very end of the text
+        const char *longs[] = {
+            "0.10000000000000000000000000000000000000000000000000000000000000",
+            "123456789012345678901234567890123456789012345678901234567890.5e-3",
+            "-0.0000000000000000000000000000000000000000000000000000000000125E+2",
+            "2.2250738585072013830902327173324040642192159804623318305533274168872e-308"};
+        for (size_t i = 0; i < sizeof(longs) / sizeof(longs[0]); i++) {
+            char text[100];
+            size_t len = strlen(longs[i]);
+            double expected = strtod(longs[i], NULL);
+            snprintf(text, sizeof(text), "[%s]", longs[i]);
+            ctx.index = 0;
+            ASSERT(jemi_json_to_cbor(text, len + 2, chunk_writer_fn, &ctx));
+            root = jemi_parse_cbor((const uint8_t *)s_json_string, ctx.index);
+            ASSERT(root->children->number == expected);
+            // no byte after the number: strtod() mustn't read past the end
+            memcpy(text, longs[i], len);
+            text[len] = '9';
+            ctx.index = 0;
+            ASSERT(jemi_json_to_cbor(text, len, chunk_writer_fn, &ctx));
+            root = jemi_parse_cbor((const uint8_t *)s_json_string, ctx.index);
+            ASSERT(root->number == expected);
+        }
+        ASSERT(strlen(longs[0]) == 64);
+
+        const char *bad[] = {"", "[1,]", "{\"a\" 1}", "[1 2]", "01", "\"abc",
+                             "[", "{}}", "tru", "\"\\ud800\"", "1 x", "{1:2}",
+                             "-", "1.", "1e", "[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]",
+                             "1e400", "[-1e400]", "[1e99999999999999999999]"};
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+            ctx.index = 0;
+            ASSERT(jemi_json_to_cbor(bad[i], strlen(bad[i]), chunk_writer_fn, &ctx) == false);
+        }
+    } while(false);
+
+    // jemi_parse_cbor() decodes with strings referenced in place
+    jemi_reset();
+    do {
+        const uint8_t cbor[] = {0xa3, 0x63, 'a', 'b', 'c', 0x83, 0x01, 0x38, 0x63, 0xf9, 0x3e, 0x00,
+                                0x61, 'b', 0xbf, 0x61, 'x', 0xf5, 0x61, 'y', 0xf7, 0xff,
+                                0x61, 'c', 0xc1, 0x9f, 0xfa, 0x3f, 0xc0, 0x00, 0x00, 0x60,
+                                0x1b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+        root = jemi_parse_cbor(cbor, sizeof(cbor));
+        jemi_node_t *big = jemi_pointer_resolve(root, "/c/2");
+        ASSERT(big->type == JEMI_INTEGER && (uint64_t)big->integer == UINT64_MAX);
+        ASSERT(renders_as(root, "{\"abc\":[1,-100,1.500000],\"b\":{\"x\":true,\"y\":null},"
+                                "\"c\":[1.500000,\"\",18446744073709551615]}"));
+        jemi_node_t *other = jemi_integer(-1); // same bits, different value
+        ASSERT(jemi_equal(big, other) == false);
+        jemi_free(other);
+        other = jemi_parse_cbor((const uint8_t *)"\x82\x1b\x80\0\0\0\0\0\0\0\x01", 11);
+        ASSERT(renders_as(other, "[9223372036854775808,1]"));
+        jemi_free(other);
+        ASSERT(root->children->string == (const char *)&cbor[2]); // not copied
+        ASSERT(jemi_pointer_resolve(root, "/abc/1")->integer == -100);
+        ASSERT(jemi_pointer_resolve(root, "/b/y")->type == JEMI_NULL);
+        jemi_node_t *copy = jemi_copy(root);
+        ASSERT(jemi_equal(root, copy));
+        jemi_string_set(copy->children, "abc");
+        ASSERT(jemi_equal(root, copy));
+        ASSERT(jemi_hash(root) == jemi_hash(copy));
+
+        size_t available = jemi_available();
+        const uint8_t *bad[] = {
+            (const uint8_t *)"\x82\x01",         // truncated
+            (const uint8_t *)"\x01\x02",         // trailing data
+            (const uint8_t *)"\x42\x01\x02",     // byte string
+            (const uint8_t *)"\x7f\x61x\xff",    // chunked string
+            (const uint8_t *)"\x63xy",           // string too long
+            (const uint8_t *)"\xbf\x61x\xff",    // map ends mid pair
+            (const uint8_t *)"\x81\xff",         // unexpected break
+            (const uint8_t *)"\x1f",             // indefinite integer
+            (const uint8_t *)"\xf0",             // unassigned simple value
+            (const uint8_t *)"\x1c",             // reserved
+            (const uint8_t *)"\xa1\x01\x02",     // key isn't text
+            (const uint8_t *)"\xa1\x80\x02",     // key isn't text
+            (const uint8_t *)"\xbf\x61x\x01\xf5\x02\xff", // key isn't text
+            (const uint8_t *)"\xf9\x7c\x00",     // Infinity
+            (const uint8_t *)"\xfa\x7f\xc0\0\0", // NaN
+            (const uint8_t *)"\xfb\xff\xf0\0\0\0\0\0\0", // -Infinity
+        };
+        const size_t bad_len[] = {2, 2, 3, 4, 3, 4, 2, 1, 1, 1, 3, 3, 7, 3, 5, 9};
+        for (size_t i = 0; i < sizeof(bad_len) / sizeof(bad_len[0]); i++) {
+            ASSERT(jemi_parse_cbor(bad[i], bad_len[i]) == NULL);
+            ASSERT(jemi_parse_cbor_requirements(bad[i], bad_len[i]) == 0);
+            ASSERT(jemi_available() == available);
+        }
+        uint8_t deep[JEMI_CBOR_MAX_DEPTH + 2];
+        memset(deep, 0x81, sizeof(deep));
+        deep[sizeof(deep) - 1] = 0x00;
+        ASSERT(jemi_parse_cbor(deep, sizeof(deep)) == NULL);
+        ASSERT(jemi_available() == available);
+        ASSERT(renders_as(jemi_parse_cbor(&deep[1], sizeof(deep) - 1),
+                          "[[[[[[[[[[[[[[[[0]]]]]]]]]]]]]]]]"));
+        // round trip through jemi_json_to_cbor()
+        const char *json = "{\"id\":\"n-1\",\"v\":[-5,0.25,false]}";
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+        char cbor2[MAX_JSON_LENGTH];
+        ASSERT(jemi_json_to_cbor(json, strlen(json), chunk_writer_fn, &ctx));
+        memcpy(cbor2, s_json_string, ctx.index);
+        ASSERT(renders_as(jemi_parse_cbor((const uint8_t *)cbor2, ctx.index),
+                          "{\"id\":\"n-1\",\"v\":[-5,0.250000,false]}"));
+        // text that needs escaping is escaped on the way out
+        jemi_reset();
+        json = "{\"a\":\"x\\\"y\",\"b\\\\\":\"\\n\\u0001\"}";
+        ctx.index = 0;
+        ASSERT(jemi_json_to_cbor(json, strlen(json), chunk_writer_fn, &ctx));
+        memcpy(cbor2, s_json_string, ctx.index);
+        ASSERT(jemi_parse_cbor_requirements((const uint8_t *)cbor2, ctx.index) == 5);
+        root = jemi_parse_cbor((const uint8_t *)cbor2, ctx.index);
+        ASSERT(root->children->sibling->length & JEMI_STRING_RAW);
+        ASSERT(jemi_pointer_resolve(root, "/a") == root->children->sibling);
+        ASSERT(renders_as(root, json));
+    } while(false);
+
+    // jemi_schema_compile() and jemi_schema_validate() check against a schema
+    jemi_reset();
+    do {
+        jemi_schema_t schema;
+        jemi_node_t *cmd, *sch = jemi_object(
+            jemi_string("$schema"), jemi_string("ignored"),
+            jemi_string("type"), jemi_string("object"),
+            jemi_string("required"), jemi_array(jemi_string("op"), jemi_string("args"), NULL),
+            jemi_string("properties"), jemi_object(
+                jemi_string("op"), jemi_object(jemi_string("enum"),
+                                               jemi_array(jemi_string("set"), jemi_string("get"), NULL),
+                                               NULL),
+                jemi_string("id"), jemi_object(jemi_string("type"), jemi_string("integer"),
+                                               jemi_string("minimum"), jemi_integer(1),
+                                               jemi_string("maximum"), jemi_float(99.5),
+                                               NULL),
+                jemi_string("args"), jemi_object(
+                    jemi_string("type"), jemi_string("array"),
+                    jemi_string("items"), jemi_object(
+                        jemi_string("type"), jemi_array(jemi_string("string"), jemi_string("null"), NULL),
+                        jemi_string("maxLength"), jemi_integer(3),
+                        NULL),
+                    NULL),
+                NULL),
+            NULL);
+        ASSERT(jemi_schema_compile(&schema, sch));
+
+        cmd = jemi_object(jemi_string("op"), jemi_string("set"),
+                          jemi_string("id"), jemi_float(7.0),
+                          jemi_string("args"), jemi_array(jemi_string("abc"), jemi_null(),
+                                                          jemi_string("\xc3\xa9t\xc3\xa9"), NULL),
+                          NULL);
+        ASSERT(jemi_schema_validate(&schema, cmd));
+        ASSERT(jemi_schema_validate(&schema, jemi_ref(cmd)));
+        jemi_string_set(cmd->children->sibling, "put");          // not in enum
+        ASSERT(!jemi_schema_validate(&schema, cmd));
+        jemi_string_set(cmd->children->sibling, "get");
+        jemi_float_set(cmd->children->sibling->sibling->sibling, 7.5);  // not an integer
+        ASSERT(!jemi_schema_validate(&schema, cmd));
+        jemi_merge_patch(cmd, jemi_object(jemi_string("id"), jemi_integer(100), NULL));
+        ASSERT(!jemi_schema_validate(&schema, cmd));              // above maximum
+        jemi_merge_patch(cmd, jemi_object(jemi_string("id"), jemi_null(), NULL));
+        ASSERT(jemi_schema_validate(&schema, cmd));               // "id" is optional
+        jemi_array_append(jemi_pointer_resolve(cmd, "/args"), jemi_string("abcd"));
+        ASSERT(!jemi_schema_validate(&schema, cmd));              // too long
+        ASSERT(!jemi_schema_validate(&schema, jemi_object(jemi_string("op"), jemi_string("get"),
+                                                          NULL)));  // missing "args"
+        ASSERT(!jemi_schema_validate(&schema, jemi_array(NULL)));
+        ASSERT(!jemi_schema_validate(&schema, NULL));
+        ASSERT(jemi_available() > 0);
+
+        jemi_reset();
+        ASSERT(jemi_schema_compile(&schema, jemi_true()));
+        ASSERT(jemi_schema_validate(&schema, jemi_integer(1)));
+        ASSERT(jemi_schema_compile(&schema, jemi_false()));
+        ASSERT(!jemi_schema_validate(&schema, jemi_integer(1)));
+        ASSERT(!jemi_schema_compile(&schema, jemi_object(jemi_string("type"), jemi_string("date"), NULL)));
+        ASSERT(!jemi_schema_compile(&schema, jemi_object(jemi_string("maxLength"), jemi_integer(-1), NULL)));
+        ASSERT(!jemi_schema_compile(&schema, jemi_integer(1)));
+
+        // nesting is limited to JEMI_SCHEMA_MAX_DEPTH
+        jemi_reset();
+        jemi_node_t *deep = jemi_true();
+        for (int i = 1; i < JEMI_SCHEMA_MAX_DEPTH; i++) {
+            deep = jemi_object(jemi_string("items"), deep, NULL);
+        }
+        ASSERT(jemi_schema_compile(&schema, deep));
+        ASSERT(!jemi_schema_compile(&schema, jemi_object(jemi_string("items"), deep, NULL)));
+    } while(false);
+
+    // jemi_iter_xxx() walk a structure without recursion
+    jemi_reset();
+    do {
+        jemi_iter_frame_t stack[2];
+        jemi_iter_t it;
+        char trace[MAX_JSON_LENGTH] = "";
+        jemi_node_t *shared = jemi_array(jemi_integer(3), NULL);
+        root = jemi_object(jemi_string("a"), jemi_array(jemi_integer(1), jemi_array(NULL), NULL),
+                           jemi_string("b"), jemi_ref(shared),
+                           jemi_string("c"), jemi_object(jemi_string("d"), jemi_array(jemi_true(), NULL), NULL),
+                           NULL);
+        jemi_list_append(root, jemi_null()); // siblings aren't visited
+
+        jemi_iter_init(&it, root, stack, 2);
+        while (jemi_iter_next(&it) != JEMI_ITER_DONE) {
+            char *p = &trace[strlen(trace)];
+            const char *key = it.key ? it.key->string : "";
+            if (it.event == JEMI_ITER_ENTER) {
+                sprintf(p, "%zu%s%c", it.level, key, it.node->type == JEMI_OBJECT ? '{' : '[');
+                if (it.key && strcmp(key, "b") == 0) {
+                    jemi_iter_skip(&it);
+                }
+            } else if (it.event == JEMI_ITER_LEAVE) {
+                sprintf(p, "%c%s ", it.node->type == JEMI_OBJECT ? '}' : ']', key);
+            } else {
+                sprintf(p, "%zu%s%c ", it.level, key, it.node->type == JEMI_INTEGER ? 'i' : '?');
+            }
+        }
+        ASSERT(strcmp(trace, "0{1a[2i 2[] ]a 1b[]b 1c{2d[]d }c } ") == 0);
+        ASSERT(it.overflow);   // "d" nests too deeply
+        ASSERT(jemi_iter_next(&it) == JEMI_ITER_DONE);
+
+        jemi_iter_init(&it, jemi_integer(7), stack, 2);
+        ASSERT(jemi_iter_next(&it) == JEMI_ITER_LEAF && it.node->integer == 7);
+        ASSERT(jemi_iter_next(&it) == JEMI_ITER_DONE && it.overflow == false);
+    } while(false);
+
+    // jemi_emit_pretty() and jemi_emit_pretty_chunked() indent the output
+    jemi_reset();
+    do {
+        json_writer_ctx ctx = {.buf=s_json_string,
+                               .buflen=sizeof(s_json_string),
+                               .index = 0};
+        jemi_pretty_t tabs = {.indent = 1, .indent_char = '\t', .newline = "\r\n"};
+        jemi_pretty_t wide = {.indent = 40, .indent_char = ' ', .newline = "\n"};
+        root = jemi_object(jemi_string("a"),
+                           jemi_array(jemi_integer(1), jemi_integer(2), NULL),
+                           jemi_string("b"), jemi_array(NULL),
+                           jemi_string("c"), jemi_object(NULL),
+                           NULL);
+        jemi_emit_pretty(root, NULL, writer_fn, &ctx);
+        ASSERT(strcmp(s_json_string, "{\n"
+                                     "  \"a\": [\n"
+                                     "    1,\n"
+                                     "    2\n"
+                                     "  ],\n"
+                                     "  \"b\": [],\n"
+                                     "  \"c\": {}\n"
+                                     "}") == 0);
+        ctx.index = 0;
+        jemi_emit_pretty_chunked(root, &tabs, chunk_writer_fn, &ctx);
+        ASSERT(strcmp(s_json_string, "{\r\n"
+                                     "\t\"a\": [\r\n"
+                                     "\t\t1,\r\n"
+                                     "\t\t2\r\n"
+                                     "\t],\r\n"
+                                     "\t\"b\": [],\r\n"
+                                     "\t\"c\": {}\r\n"
+                                     "}") == 0);
+        // indentation longer than one precomputed run
+        ctx.index = 0;
+        jemi_emit_pretty_chunked(jemi_array(jemi_array(jemi_true(), NULL), NULL),
+                                 &wide, chunk_writer_fn, &ctx);
+        ASSERT(strlen(s_json_string) == 1 + 1 + 40 + 1 + 1 + 80 + 4 + 1 + 40 + 1 + 1 + 1);
+        ASSERT(strncmp(&s_json_string[124], "true\n", 5) == 0);
+        // compact output is unchanged
+        ASSERT(renders_as(root, "{\"a\":[1,2],\"b\":[],\"c\":{}}"));
+    } while(false);
+
+    // jemi_length() tracks children as containers are built and modified
+    jemi_reset();
+    do {
+        static const int64_t ints[] = {1, 2, 3};
+        static const char *const keys[] = {"a", "b"};
+        jemi_node_t *array, *object, *patch, *v2;
+
+        ASSERT(jemi_length(jemi_array(NULL)) == 0);
+        ASSERT(jemi_length(jemi_integer(1)) == 0);
+        ASSERT(jemi_length(NULL) == 0);
+        array = jemi_array(jemi_integer(1), jemi_integer(2), NULL);
+        ASSERT(jemi_length(array) == 2);
+        jemi_array_append(array, jemi_list(jemi_true(), jemi_false(), NULL));
+        ASSERT(jemi_length(array) == 4);
+        ASSERT(jemi_length(jemi_ref(array)) == 4);
+        ASSERT(jemi_length(jemi_copy(array)) == 4);
+        ASSERT(jemi_length(jemi_array_from_ints(ints, 3)) == 3);
+
+        object = jemi_object(jemi_string("a"), jemi_integer(1), NULL);
+        ASSERT(jemi_length(object) == 1);
+        jemi_object_add_keyval(object, "b", jemi_null());
+        ASSERT(jemi_length(object) == 2);
+        ASSERT(jemi_length(jemi_object_from_column(keys, JEMI_INTEGER, ints, 2)) == 2);
+
+        // removal via merge patch
+        patch = jemi_object(jemi_string("a"), jemi_null(),
+                            jemi_string("c"), array,
+                            NULL);
+        jemi_merge_patch(object, patch);
+        ASSERT(jemi_length(object) == 2);
+        ASSERT(renders_as(object, "{\"b\":null,\"c\":[1,2,true,false]}"));
+
+        // persistent updates keep counts in both versions
+        v2 = jemi_persist_remove(object, object->children);
+        ASSERT(jemi_length(object) == 2);
+        ASSERT(jemi_length(v2) == 1);
+        v2 = jemi_persist_append(object, object->children->sibling->sibling->sibling,
+                                 jemi_integer(5));
+        ASSERT(jemi_length(v2->children->sibling->sibling->sibling) == 5);
+
+        // equal content, different length
+        ASSERT(!jemi_equal(jemi_array(jemi_integer(1), NULL),
+                           jemi_array(jemi_integer(1), jemi_integer(1), NULL)));
+
+        // children relinked by hand leave a stale count, which jemi_equal()
+        // and jemi_persist_xxx() don't rely on
+        jemi_reset();
+        array = jemi_array(jemi_integer(1), NULL);
+        array->children->sibling = jemi_integer(2);
+        ASSERT(jemi_length(array) == 1);
+        ASSERT(jemi_equal(array, jemi_array(jemi_integer(1), jemi_integer(2), NULL)));
+        root = jemi_array(array, NULL);
+        v2 = jemi_integer(3);
+        while (jemi_available() > 3) {
+            jemi_null(); // the append needs 4: array, its 2 children and root
+        }
+        ASSERT(jemi_persist_append(root, array, v2) == NULL);
+        ASSERT(jemi_available() == 3); // refused before allocating any
+    } while(false);
+
+    // jemi_parse_cbor_requirements() counts nodes without allocating any
+    jemi_reset();
+    do {
+        // {"a":[1,"xy",null],"b":{}} with an indefinite array and a tag
+        const uint8_t cbor[] = {0xa2, 0x61, 'a', 0x9f, 0x01, 0xc1, 0x62, 'x', 'y', 0xf6, 0xff,
+                                0x61, 'b', 0xa0};
+        size_t available = jemi_available();
+        size_t needed = jemi_parse_cbor_requirements(cbor, sizeof(cbor));
+        ASSERT(needed == 8);
+        ASSERT(jemi_available() == available);
+        ASSERT(jemi_parse_cbor_requirements((const uint8_t *)"\x82\x01", 2) == 0);
+        ASSERT(jemi_parse_cbor_requirements((const uint8_t *)"\xf0", 1) == 0);
+        root = jemi_parse_cbor(cbor, sizeof(cbor));
+        ASSERT(renders_as(root, "{\"a\":[1,\"xy\",null],\"b\":{}}"));
+        ASSERT(jemi_available() == available - needed);
+
+        // with exactly that many nodes the parse succeeds, with one fewer it
+        // fails cleanly, as do the constructors
+        jemi_node_t pool[8];
+        jemi_init(pool, 8);
+        ASSERT(renders_as(jemi_parse_cbor(cbor, sizeof(cbor)),
+                          "{\"a\":[1,\"xy\",null],\"b\":{}}"));
+        jemi_init(pool, 7);
+        ASSERT(jemi_parse_cbor(cbor, sizeof(cbor)) == NULL);
+        ASSERT(jemi_available() == 7);
+        jemi_init(pool, 1);
+        ASSERT(jemi_array(jemi_integer(1), NULL) == NULL);
+        ASSERT(jemi_object(NULL) == NULL);
+        ASSERT(jemi_concat(NULL) == NULL);
+        jemi_init(s_jemi_pool, JEMI_POOL_SIZE);
+    } while(false);
+
+    // jemi_footprint() and jemi_pool_dump() show what is using the pool
+    jemi_reset();
+    do {
+        jemi_footprint_t fp;
+        jemi_pool_state_t states[JEMI_POOL_SIZE];
+        jemi_node_t *shared, *lost, *roots[1];
+
+        shared = jemi_array(jemi_integer(1), NULL);
+        root = jemi_object(jemi_string("name"), jemi_string_n("abcdef", 3),
+                           jemi_string("list"), jemi_array(jemi_null(), jemi_false(), jemi_true(), NULL),
+                           jemi_string("msg"), jemi_concat(jemi_string("hi "), jemi_integer(7), NULL),
+                           jemi_string("ref"), jemi_ref(shared),
+                           NULL);
+        jemi_footprint(root, &fp);
+        ASSERT(fp.nodes == 14);
+        ASSERT(fp.by_type[JEMI_STRING] == 6);
+        ASSERT(fp.by_type[JEMI_REF] == 1 && fp.by_type[JEMI_INTEGER] == 1);
+        ASSERT(fp.string_bytes == 4 + 3 + 4 + 3 + 3 + 3);
+        ASSERT(fp.max_depth == 2);
+        ASSERT(fp.max_fanout == 4);
+        lost = jemi_integer(1);
+        jemi_footprint(lost, &fp);
+        ASSERT(fp.nodes == 1 && fp.max_depth == 0 && fp.max_fanout == 0);
+        jemi_free(lost);
+
+        lost = jemi_list(jemi_string("dropped"), jemi_integer(2), NULL);
+        roots[0] = root;
+        ASSERT(jemi_pool_dump(roots, 1, states) == 2);
+        ASSERT(states[lost - s_jemi_pool] == JEMI_POOL_LEAKED);
+        ASSERT(states[shared->children - s_jemi_pool] == JEMI_POOL_LIVE); // via the ref
+        ASSERT(states[root - s_jemi_pool] == JEMI_POOL_LIVE);
+        ASSERT(states[0] == JEMI_POOL_FREE); // the pool is used from the end
+        jemi_free(lost->sibling);
+        jemi_free(lost);
+        ASSERT(jemi_pool_dump(roots, 1, states) == 0);
+        ASSERT(jemi_pool_dump(NULL, 0, states) == 16);
+    } while(false);
+
+    // jemi_persist_xxx() create new versions that share unchanged subtrees
+    jemi_reset();
+    do {
+        jemi_node_t *v1, *v2, *v3, *temp, *temp2, *rgb;
+        size_t available;
+
+        v1 = jemi_object(jemi_string("name"), jemi_string("dev"),
+                         jemi_string("temp"), temp = jemi_integer(20),
+                         jemi_string("rgb"), rgb = jemi_array(jemi_integer(1), jemi_integer(2), NULL),
+                         NULL);
+        available = jemi_available();
+        v2 = jemi_persist_set(v1, temp, temp2 = jemi_integer(21));
+        ASSERT(renders_as(v1, "{\"name\":\"dev\",\"temp\":20,\"rgb\":[1,2]}"));
+        ASSERT(renders_as(v2, "{\"name\":\"dev\",\"temp\":21,\"rgb\":[1,2]}"));
+        // new value + copies of the root and the three preceding nodes
+        ASSERT(jemi_available() == available - 5);
+
+        v3 = jemi_persist_append(v2, rgb, jemi_integer(3));
+        ASSERT(renders_as(v2, "{\"name\":\"dev\",\"temp\":21,\"rgb\":[1,2]}"));
+        ASSERT(renders_as(v3, "{\"name\":\"dev\",\"temp\":21,\"rgb\":[1,2,3]}"));
+
+        ASSERT(renders_as(jemi_persist_remove(v2, temp2), "{\"name\":\"dev\",\"rgb\":[1,2]}"));
+        ASSERT(renders_as(jemi_persist_remove(v1, rgb), "{\"name\":\"dev\",\"temp\":20}"));
+        ASSERT(renders_as(v1, "{\"name\":\"dev\",\"temp\":20,\"rgb\":[1,2]}"));
+
+        // target not found in root
+        ASSERT(jemi_persist_set(v1, temp2, jemi_null()) == NULL);
+        // only arrays and objects (or references to them) can be appended to
+        available = jemi_available();
+        ASSERT(jemi_persist_append(v1, temp, jemi_integer(3)) == NULL);
+        ASSERT(jemi_available() == available - 1);
+        v2 = jemi_object(jemi_string("ref"), jemi_ref(rgb), NULL);
+        ASSERT(renders_as(jemi_persist_append(v2, v2->children->sibling, jemi_integer(3)),
+                          "{\"ref\":[1,2,3]}"));
+        ASSERT(renders_as(v2, "{\"ref\":[1,2]}"));
+
+        // too few nodes to copy the whole path: nothing is taken
+        jemi_node_t pool[13];
+        jemi_init(pool, 13);
+        v1 = jemi_object(jemi_string("a"), jemi_integer(1),
+                         jemi_string("b"), jemi_array(jemi_integer(1), rgb = jemi_integer(2), NULL),
+                         NULL);
+        temp2 = jemi_integer(3);
+        ASSERT(jemi_available() == 5); // path needs root, "a", 1, "b", array, 1
+        ASSERT(jemi_persist_set(v1, rgb, temp2) == NULL);
+        ASSERT(jemi_persist_append(v1, v1->children->sibling->sibling->sibling, temp2) == NULL);
+        ASSERT(jemi_available() == 5);
+        ASSERT(renders_as(jemi_persist_remove(v1, v1->children), "{\"b\":[1,2]}"));
+        ASSERT(jemi_available() == 4);
+        jemi_init(s_jemi_pool, JEMI_POOL_SIZE);
+    } while(false);
+
+#ifdef JEMI_GENERATIONS
+    // jemi_emit_since() reports changes made by jemi_persist_xxx()
+    jemi_reset();
+    do {
+        jemi_node_t *v1, *v2, *v3, *value, *green, *late;
+        uint32_t sent;
+
+        v1 = jemi_object(jemi_string("a"), jemi_object(jemi_string("b"), jemi_integer(1),
+                                                       jemi_string("c"), jemi_integer(2),
+                                                       NULL),
+                         jemi_string("rgb"), jemi_array(jemi_integer(1),
+                                                        green = jemi_integer(2),
+                                                        jemi_integer(3), NULL),
+                         NULL);
+        value = jemi_object(jemi_string("d"), jemi_integer(4), NULL);
+        late = jemi_list(jemi_string("e"), jemi_integer(5), NULL);
+        sent = jemi_generation();
+        v2 = jemi_persist_set(v1, jemi_pointer_resolve(v1, "/a/b"), jemi_integer(24));
+        ASSERT(renders_as_since(v2, sent, "{\"a\":{\"b\":24}}"));
+        ASSERT(renders_as_since(v1, sent, "{}"));
+        v3 = jemi_persist_remove(v2, green);
+        ASSERT(renders_as_since(v3, sent, "{\"a\":{\"b\":24},\"rgb\":[1,3]}"));
+        ASSERT(renders_as_since(v2, sent, "{\"a\":{\"b\":24}}"));
+        // a value set before sent is still sent whole
+        v3 = jemi_persist_set(v1, jemi_pointer_resolve(v1, "/a"), value);
+        ASSERT(renders_as_since(v3, sent, "{\"a\":{\"d\":4}}"));
+        // so is a member built before sent and appended after it
+        v3 = jemi_persist_append(v1, v1, late);
+        ASSERT(renders_as_since(v3, sent, "{\"e\":5}"));
+        ASSERT(renders_as_since(v1, sent, "{}"));
+    } while(false);
+#endif
+
     printf("\nINFO: %ld out of %d free nodes available",
            jemi_available(),
            JEMI_POOL_SIZE);
@@ -329,6 +1449,66 @@ static void writer_fn(char c, void *arg) {
   }
 }
 
+static void chunk_writer_fn(const char *buf, size_t len, void *arg) {
+  json_writer_ctx *ctx = (json_writer_ctx *)arg;
+  while (len-- > 0 && ctx->index + 1 < ctx->buflen) {
+    ctx->buf[ctx->index++] = *buf++;
+  }
+  ctx->buf[ctx->index] = '\0';
+}
+
+static size_t spill_reader_fn(size_t offset, size_t len, char *buf,
+                              const char **data, void *arg) {
+  json_writer_ctx *ctx = (json_writer_ctx *)arg;
+  if (offset + len > ctx->index) {
+    return 0;
+  } else if (len > JEMI_CHUNK_SIZE) {
+    *data = &ctx->buf[offset];
+  } else {
+    memcpy(buf, &ctx->buf[offset], len);
+  }
+  return len;
+}
+
+#ifdef JEMI_GENERATIONS
+static bool renders_as_since(jemi_node_t *node, uint32_t generation, const char *expected) {
+    json_writer_ctx ctx = {.buf=s_json_string,
+                           .buflen=sizeof(s_json_string),
+                           .index = 0};
+    jemi_emit_since(node, generation, writer_fn, &ctx);
+    printf("\nrendering: %s", s_json_string);
+    return strcmp(s_json_string, expected) == 0;
+}
+#endif
+
+static void match_fn(jemi_node_t *node, void *arg) {
+    query_results_t *results = (query_results_t *)arg;
+    if (results->n_matches < 8) {
+        results->matches[results->n_matches++] = node;
+    }
+}
+
+static bool queries_as(jemi_node_t *root, const char *path, const char *expected) {
+    jemi_query_t query;
+    query_results_t results = {.n_matches = 0};
+    jemi_node_t *list = NULL;
+    bool ok;
+
+    if (!jemi_query_compile(&query, path)) {
+        printf("\nfailed to compile %s", path);
+        return false;
+    }
+    ok = jemi_query_run(&query, root, match_fn, &results) == (int)results.n_matches;
+    // render the matches as an array of copies
+    for (size_t i = 0; i < results.n_matches; i++) {
+        jemi_node_t *copy = jemi_true();
+        *copy = *results.matches[i];
+        copy->sibling = NULL;
+        list = jemi_list_append(list, copy);
+    }
+    return renders_as(jemi_array_append(jemi_array(NULL), list), expected) && ok;
+}
+
 static bool renders_as(jemi_node_t *node, const char *expected) {
     json_writer_ctx ctx = {.buf=s_json_string,
                            .buflen=sizeof(s_json_string),
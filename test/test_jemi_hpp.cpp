@@ -0,0 +1,218 @@
+/**
+ * @file test_jemi_hpp.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 R. Dunbar Poor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+To run the tests (on a POSIX / gcc style environment):
+
+gcc -c -g -Wall -I.. ../jemi.c && g++ -std=c++17 -g -Wall -I.. -o test_jemi_hpp test_jemi_hpp.cpp jemi.o && ./test_jemi_hpp && rm -rf ./test_jemi_hpp ./test_jemi_hpp.dSYM ./jemi.o
+
+Use -std=c++20 to also test the views with std::ranges.
+
+*/
+
+// *****************************************************************************
+// Includes
+
+#include "jemi.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <list>
+#include <memory_resource>
+#include <new>
+#include <numeric>
+#include <vector>
+
+// *****************************************************************************
+// Private types and definitions
+
+#define JEMI_POOL_SIZE 16
+
+#define ASSERT(e) check(e, #e, __FILE__, __LINE__)
+
+// *****************************************************************************
+// Private (static) storage
+
+static jemi_node_t s_jemi_pool[JEMI_POOL_SIZE];
+
+// *****************************************************************************
+// Private (static, forward) declarations
+
+/**
+ * @brief Print an error message on stdout if expr is false.
+ */
+static void check(bool expr, const char *str, const char *file, int line);
+
+// *****************************************************************************
+// Public code
+
+int main() {
+    std::printf("\nStarting test_jemi_hpp...");
+
+    // jemi::children() iterates over the elements of an array in place
+    jemi_init(s_jemi_pool, JEMI_POOL_SIZE);
+    do {
+        jemi_node_t *array = jemi_array(jemi_integer(1), jemi_integer(2),
+                                        jemi_integer(3), NULL);
+        jemi::children_view view = jemi::children(array);
+        int64_t sum = 0;
+
+        for (jemi_node_t &node : view) {
+            node.integer *= 10;
+            sum += node.integer;
+        }
+        ASSERT(sum == 60);
+        ASSERT(view.size() == 3);
+        ASSERT(std::distance(view.begin(), view.end()) == 3);
+        ASSERT(std::find_if(view.begin(), view.end(), [](const jemi_node_t &n) {
+                   return n.integer == 20;
+               })->integer == 20);
+        // references are followed, other nodes have no children
+        ASSERT(jemi::children(jemi_ref(array)).size() == 3);
+        ASSERT(jemi::children(jemi_ref(array)).begin() == view.begin());
+        ASSERT(jemi::children(jemi_integer(4)).size() == 0);
+        ASSERT(jemi::children(jemi_integer(4)).begin() ==
+               jemi::children(nullptr).end());
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+        auto big = view | std::views::filter([](const jemi_node_t &n) {
+                       return n.integer > 15;
+                   });
+        ASSERT(std::ranges::distance(big) == 2);
+#endif
+    } while (false);
+
+    // jemi::members() iterates over the key/value pairs of an object
+    jemi_reset();
+    do {
+        jemi_node_t *object = jemi_object(jemi_string("a"), jemi_integer(1),
+                                          jemi_string_n("bc", 1), jemi_true(),
+                                          NULL);
+        std::vector<std::string_view> keys;
+        size_t n_true = 0;
+
+        for (auto [key, value] : jemi::members(object)) {
+            keys.push_back(jemi::text(*key));
+            n_true += (value->type == JEMI_TRUE);
+        }
+        ASSERT(keys.size() == 2 && keys[0] == "a" && keys[1] == "b");
+        ASSERT(n_true == 1);
+        ASSERT(jemi::members(object).size() == 2);
+        ASSERT(jemi::members(jemi_ref(object)).size() == 2);
+        ASSERT(jemi::members(jemi_array(NULL)).size() == 0);
+        // an object's children are its keys and values in turn
+        ASSERT(jemi::children(object).size() == 4);
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+        auto names = jemi::members(object) |
+                     std::views::transform([](jemi::member m) {
+                         return jemi::text(*m.key);
+                     });
+        ASSERT(*std::ranges::begin(names) == "a");
+#endif
+    } while (false);
+
+    // jemi::pool_resource serves small allocations from the pool
+    jemi_reset();
+    do {
+        jemi::pool_resource resource(s_jemi_pool, JEMI_POOL_SIZE,
+                                     std::pmr::null_memory_resource());
+        size_t available = jemi_available();
+        {
+            std::pmr::vector<char> vector(&resource);
+            vector.reserve(sizeof(jemi_node_t)); // exactly one node
+            vector.assign(sizeof(jemi_node_t), 'x');
+            ASSERT(jemi_available() == available - 1);
+            ASSERT(std::count(vector.begin(), vector.end(), 'x') ==
+                   (long)sizeof(jemi_node_t));
+            // too large for a node: goes upstream, which refuses it
+            bool refused = false;
+            try {
+                vector.reserve(sizeof(jemi_node_t) + 1);
+            } catch (const std::bad_alloc &) {
+                refused = true;
+            }
+            ASSERT(refused);
+            ASSERT(vector.size() == sizeof(jemi_node_t));
+        }
+        ASSERT(jemi_available() == available);
+
+        std::pmr::list<int> list(&resource);
+        for (int i = 0; i < 10; i++) {
+            list.push_back(i);
+        }
+        ASSERT(jemi_available() == available - 10);
+        ASSERT(std::accumulate(list.begin(), list.end(), 0) == 45);
+        list.clear();
+        ASSERT(jemi_available() == available);
+        // nodes returned by the resource can be used by jemi again
+        ASSERT(jemi_integer(1) != NULL);
+    } while (false);
+
+    // once the pool is exhausted, requests go upstream
+    jemi_reset();
+    do {
+        jemi::pool_resource resource(s_jemi_pool, JEMI_POOL_SIZE,
+                                     std::pmr::null_memory_resource());
+        std::pmr::list<int> list(&resource);
+        bool refused = false;
+
+        try {
+            for (int i = 0; i <= JEMI_POOL_SIZE; i++) {
+                list.push_back(i);
+            }
+        } catch (const std::bad_alloc &) {
+            refused = true;
+        }
+        ASSERT(refused);
+        ASSERT(list.size() == JEMI_POOL_SIZE);
+        ASSERT(jemi_available() == 0);
+        ASSERT(jemi_null() == NULL);
+        list.clear();
+        ASSERT(jemi_available() == JEMI_POOL_SIZE);
+
+        // with a heap upstream, the pool is used first
+        jemi::pool_resource heap(s_jemi_pool, JEMI_POOL_SIZE);
+        std::pmr::list<int> mixed(&heap);
+        for (int i = 0; i < 2 * JEMI_POOL_SIZE; i++) {
+            mixed.push_back(i);
+        }
+        ASSERT(jemi_available() == 0);
+        ASSERT(mixed.size() == 2 * JEMI_POOL_SIZE);
+        mixed.clear();
+        ASSERT(jemi_available() == JEMI_POOL_SIZE);
+    } while (false);
+
+    std::printf("\n... Finished test_jemi_hpp\n");
+}
+
+// *****************************************************************************
+// Private (static) code
+
+static void check(bool expr, const char *str, const char *file, int line) {
+    if (!expr) {
+        std::printf("\nassertion %s failed at %s:%d", str, file, line);
+    }
+}